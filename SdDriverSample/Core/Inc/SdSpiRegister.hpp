@@ -0,0 +1,53 @@
+#ifndef SD_SPI_REGISTER_HPP
+#define SD_SPI_REGISTER_HPP
+
+#include "main.h"
+
+// ----------------------------------------------------------------------
+//  SPI のデータ/ステータスレジスタアクセス (SdRegisterTransport 用)
+// ----------------------------------------------------------------------
+// DR は 8bit アクセスで 1 フレーム、16bit アクセスで 2 フレームを
+// まとめて (パッキング) 読み書きする。32bit アクセスは使わないこと。
+// (HAL と同じくポインタ経由でアクセスする)
+// ホストビルドでは Host/Inc の同名ファイル (エミュレーション) に差し替わる。
+namespace SdSpiRegister {
+
+static inline bool IsTxEmpty(SPI_TypeDef *spi)
+{
+	return (spi->SR & SPI_SR_TXE) != 0;
+}
+
+static inline bool IsRxNotEmpty(SPI_TypeDef *spi)
+{
+	return (spi->SR & SPI_SR_RXNE) != 0;
+}
+
+static inline void WriteData8(SPI_TypeDef *spi, uint8_t data)
+{
+	volatile uint8_t *pDr = reinterpret_cast<volatile uint8_t*>(&spi->DR);
+	*pDr = data;
+}
+
+// 下位バイトが先に送信される
+static inline void WriteData16(SPI_TypeDef *spi, uint16_t data)
+{
+	volatile uint16_t *pDr = reinterpret_cast<volatile uint16_t*>(&spi->DR);
+	*pDr = data;
+}
+
+static inline uint8_t ReadData8(SPI_TypeDef *spi)
+{
+	volatile uint8_t *pDr = reinterpret_cast<volatile uint8_t*>(&spi->DR);
+	return *pDr;
+}
+
+// 先に受信したバイトが下位バイトに入る
+static inline uint16_t ReadData16(SPI_TypeDef *spi)
+{
+	volatile uint16_t *pDr = reinterpret_cast<volatile uint16_t*>(&spi->DR);
+	return *pDr;
+}
+
+}
+
+#endif /* SD_SPI_REGISTER_HPP */
@@ -7,10 +7,63 @@ namespace SD {
 
 constexpr uint32_t SECTOR_SIZE = 512;
 
+// 初期化 (カード識別) 中の最大クロック [Hz]
+constexpr uint32_t IDENTIFICATION_CLOCK_MAX = 400000;
+// デフォルトスピードモードの最大クロック [Hz]
+// (CMD6 でハイスピードモードに切り替えない限りこれが上限)
+constexpr uint32_t DEFAULT_SPEED_CLOCK_MAX = 25000000;
+
+// タイムアウトの上限 [ms]
+// SDHC/SDXC ではカードの値によらずこの値を使うことが推奨されている
+// (Physical Layer Simplified Specification 4.6.2)
+constexpr uint32_t INIT_TIMEOUT_MS           = 1000;	// ACMD41 の初期化完了待ち
+constexpr uint32_t READ_TIMEOUT_MAX_MS       = 100;		// データ開始トークン待ち
+constexpr uint32_t WRITE_TIMEOUT_MAX_MS      = 250;		// 書き込み Busy 待ち
+constexpr uint32_t WRITE_TIMEOUT_SDXC_MS     = 500;		// 書き込み Busy 待ち (SDXC)
+constexpr uint32_t ERASE_TIMEOUT_PER_AU_MS   = 250;		// SSR に消去時間が無い場合の 1 AU あたりの消去時間
+
+// SDXC (32GB 超) のセクタ数
+constexpr uint32_t SDXC_SECTOR_COUNT_MIN = 67108864;
+
+// R1 レスポンスが来なかった場合の値 (bit7 が 1 なので R1 とは区別できる)
+constexpr uint8_t R1_NO_RESPONSE = 0xFF;
+
+// 処理結果
+enum class Result {
+	Ok = 0,
+	Timeout,			// カードの応答/Busy 解除/データ開始トークンが時間内に来なかった
+	R1Error,			// R1 のエラービットが立っていた (SdDriver::GetLastR1() で確認できる)
+	CrcError,			// 受信データの CRC 不一致、または送信データが CRC エラーで拒否された
+	WriteError,			// 送信データが書き込みエラーで拒否された
+	DataError,			// 読み出し時にデータエラートークンを受け取った
+	OutOfRange,			// セクタ番号がカードの容量を超えている
+	InvalidArgument,	// 引数の誤り (nullptr など)
+	InvalidState,		// 逐次読み出しの開始/終了の順序が誤っている
+	NotSupported,		// 対応していないカード (SD Ver.1, バイトアドレッシング)
+	TransportError,		// SPI の転送自体が失敗した (HAL のタイムアウト、DMA の転送エラーなど)
+};
+
+// データエラートークン形式 (0000xxxx)
+constexpr uint8_t DATA_ERROR_TOKEN_MASK = 0xF0;
+enum class DataErrorToken : uint8_t {
+	Error         = 0x01,
+	CcError       = 0x02,
+	CardEccFailed = 0x04,
+	OutOfRange    = 0x08,
+};
+
 constexpr uint8_t DATA_START_TOKEN_EXCEPT_CMD25 = 0xFE;
 constexpr uint8_t DATA_START_TOKEN_CMD25 = 0xFC;
 constexpr uint8_t DATA_STOP_TOKEN = 0xFD;
 
+// データレスポンス形式 (xxx0sss1)
+constexpr uint8_t DATA_RESPONSE_MASK = 0x1F;
+enum class DataResponse : uint8_t {
+	Accepted   = 0x05,	// 010: データ受理
+	CrcError   = 0x0B,	// 101: CRC エラーにより拒否
+	WriteError = 0x0D,	// 110: 書き込みエラーにより拒否
+};
+
 // レスポンス形式
 enum class ResponseType {
 	R1 = 0,		// [ R1 (8bit) ]
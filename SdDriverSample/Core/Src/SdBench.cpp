@@ -0,0 +1,705 @@
+#include "SdBench.hpp"
+#include "SdTimer.hpp"
+#include "SdWriteCache.hpp"
+#include "SdReadAhead.hpp"
+#include "SdSectorCache.hpp"
+#include "SdCrc.hpp"
+#include <cstring>
+#include <cstdlib>
+
+// seqw で 1 回の CMD25 にまとめるセクタ数 (作業バッファは 512 バイト x この値)
+#ifndef SD_BENCH_CHUNK_SECTORS
+#define SD_BENCH_CHUNK_SECTORS 4
+#endif
+
+// p99 算出のために保持する最大値側のレイテンシの個数
+#ifndef SD_BENCH_TOP_COUNT
+#define SD_BENCH_TOP_COUNT 64
+#endif
+
+// ----------------------------------------------------------------------
+//  static private functions
+// ----------------------------------------------------------------------
+namespace {
+
+// ランダム系 (rndr/rndw/lru) で指定できる最大の操作回数
+// p99 を正確に求められる範囲 (上位 1% が SD_BENCH_TOP_COUNT 個に収まる範囲)。
+// 連続系はセクタ数で操作回数が決まるので制限せず、超えた分の p99 は上限値として表示する。
+constexpr uint32_t MaxOperationCount = SD_BENCH_TOP_COUNT * 100 - 1;
+
+uint8_t g_BenchBuffer[SD::SECTOR_SIZE * SD_BENCH_CHUNK_SECTORS];
+
+/**
+ * 1 操作ごとのレイテンシを集計する
+ * 全件は保持せず、p99 に必要な上位の値だけを大きい順に保持する。
+ */
+class LatencyStats
+{
+private:
+	uint32_t m_Count;
+	uint64_t m_TotalCycles;
+	uint32_t m_Top[SD_BENCH_TOP_COUNT];
+	uint32_t m_TopCount;
+
+public:
+	LatencyStats()
+		: m_Count(0)
+		, m_TotalCycles(0)
+		, m_TopCount(0)
+	{
+	}
+
+	void Add(uint32_t cycles)
+	{
+		m_Count++;
+		m_TotalCycles += cycles;
+
+		// 挿入ソートで上位のみ残す
+		uint32_t i = m_TopCount;
+		if (i == SD_BENCH_TOP_COUNT) {
+			if (cycles <= m_Top[i - 1]) {
+				return;
+			}
+			i--;
+		} else {
+			m_TopCount++;
+		}
+		while ((i > 0) && (m_Top[i - 1] < cycles)) {
+			m_Top[i] = m_Top[i - 1];
+			i--;
+		}
+		m_Top[i] = cycles;
+	}
+
+	uint32_t GetCount() const
+	{
+		return m_Count;
+	}
+
+	uint32_t GetMeanCycles() const
+	{
+		return (m_Count == 0) ? 0 : static_cast<uint32_t>(m_TotalCycles / m_Count);
+	}
+
+	uint32_t GetMaxCycles() const
+	{
+		return (m_TopCount == 0) ? 0 : m_Top[0];
+	}
+
+	// Nearest-rank 法による 99 パーセンタイル
+	// IsPercentile99Bound() が true の場合は保持している最小の値 (真の p99 以上) を返す。
+	uint32_t GetPercentile99Cycles() const
+	{
+		if (m_TopCount == 0) {
+			return 0;
+		}
+		uint32_t index = GetPercentile99Index();
+		if (index >= m_TopCount) {
+			index = m_TopCount - 1;
+		}
+		return m_Top[index];
+	}
+
+	// p99 の順位が保持している上位の範囲を超えたか (操作回数が MaxOperationCount を超えた場合)
+	bool IsPercentile99Bound() const
+	{
+		return (m_TopCount != 0) && (GetPercentile99Index() >= m_TopCount);
+	}
+
+private:
+	// p99 の値の、大きい方から数えた添え字
+	uint32_t GetPercentile99Index() const
+	{
+		uint32_t rank = static_cast<uint32_t>((static_cast<uint64_t>(m_Count) * 99 + 99) / 100);	// 小さい方から数えた順位 (1 始まり)
+		return m_Count - rank;
+	}
+};
+
+/**
+ * 全体の所要サイクル数を 64bit で積算する
+ * CYCCNT は SYSCLK 32MHz で約 134 秒で一周するので、一周する前に (1 操作ごとに) Update() で差分を足し込む。
+ */
+class Stopwatch
+{
+private:
+	uint32_t m_LastCycles;
+	uint64_t m_TotalCycles;
+
+public:
+	Stopwatch()
+		: m_LastCycles(SdTimer::GetCycles())
+		, m_TotalCycles(0)
+	{
+	}
+
+	void Update()
+	{
+		uint32_t now = SdTimer::GetCycles();
+		m_TotalCycles += now - m_LastCycles;
+		m_LastCycles = now;
+	}
+
+	uint64_t GetElapsedCycles()
+	{
+		Update();
+		return m_TotalCycles;
+	}
+};
+
+// ランダムアクセス用の擬似乱数 (毎回同じ系列になるよう種は固定)
+class Random
+{
+private:
+	uint32_t m_State;
+
+public:
+	Random()
+		: m_State(0x12345678)
+	{
+	}
+
+	// xorshift32
+	uint32_t Next()
+	{
+		m_State ^= m_State << 13;
+		m_State ^= m_State >> 17;
+		m_State ^= m_State << 5;
+		return m_State;
+	}
+};
+
+void PrintUsage()
+{
+	printf("Usage:\n");
+	printf("  bench seqr <lba> <sectors>       : Sequential read  (CMD18)\n");
+	printf("  bench seqw <lba> <sectors>       : Sequential write (CMD25, %d sectors/cmd)\n", SD_BENCH_CHUNK_SECTORS);
+	printf("  bench rndr <lba> <span> <count>  : Random read  (CMD17)\n");
+	printf("  bench rndw <lba> <span> <count>  : Random write (CMD24)\n");
+	printf("  bench cmp  <lba> <sectors>       : CMD17 loop vs CMD18\n");
+	printf("  bench logw <lba> <sectors>       : 1-sector appends, CMD24 vs write cache\n");
+	printf("  bench ra   <lba> <sectors>       : 1-sector sequential reads, CMD17 vs read-ahead\n");
+	printf("  bench lru  <lba> <span> <count>  : Random reads, CMD17 vs sector cache\n");
+	printf("  bench stream <lba> <sectors> [us]: CMD18 + consumer (+us busy/sector), single vs double buffer\n");
+	printf("  bench sum  <lba> <sectors>       : CMD18 + checksum callback (ReadSectors)\n");
+	printf("  bench sg   <lba> <sectors>       : Scattered buffers, CMD17/CMD24 loop vs CMD18/CMD25 (%d sectors/cmd)\n", SD_BENCH_CHUNK_SECTORS);
+	printf("  * <count> of random benchmarks: 1-%lu. p99 of longer sequential runs is shown as an upper bound (p99<=).\n", MaxOperationCount);
+	printf("  * Write benchmarks destroy the data in the range.\n");
+}
+
+/**
+ * 結果を 1 行で出力する
+ * @param pName 表示名
+ * @param bytes 転送したバイト数
+ * @param elapsedCycles 全体の所要サイクル数 (コマンド発行やストップを含む)
+ * @param stats 1 操作ごとのレイテンシ
+ */
+void PrintResult(const char *pName, uint64_t bytes, uint64_t elapsedCycles, const LatencyStats &stats)
+{
+	uint64_t elapsedUs = elapsedCycles / (SystemCoreClock / 1000000);
+	if (elapsedUs == 0) {
+		elapsedUs = 1;
+	}
+	// 1 バイト/us = 1 MB/s (1 MB = 10^6 バイト) なので小数 3 桁分を整数で求める
+	uint32_t milliMbps = static_cast<uint32_t>(bytes * 1000 / elapsedUs);
+	uint32_t iops = static_cast<uint32_t>(static_cast<uint64_t>(stats.GetCount()) * 1000000 / elapsedUs);
+	// 全体の時間は 32bit の us では約 71 分で溢れるので ms で表示する
+	uint32_t elapsedMs = static_cast<uint32_t>(elapsedUs / 1000);
+
+	printf("  %-6s %3lu.%03lu MB/s %6lu IOPS  mean %6lu us  p99%s%6lu us  max %6lu us  (%lu ops, %lu.%03lu ms)\n",
+		pName,
+		milliMbps / 1000, milliMbps % 1000,
+		iops,
+		SdTimer::CyclesToMicroseconds(stats.GetMeanCycles()),
+		stats.IsPercentile99Bound() ? "<=" : " ",
+		SdTimer::CyclesToMicroseconds(stats.GetPercentile99Cycles()),
+		SdTimer::CyclesToMicroseconds(stats.GetMaxCycles()),
+		stats.GetCount(),
+		elapsedMs, static_cast<uint32_t>(elapsedUs % 1000));
+}
+
+// セクタ数を転送バイト数にする (カード全体を指定しても溢れないよう 64bit で求める)
+uint64_t GetBytes(uint32_t sectors)
+{
+	return static_cast<uint64_t>(sectors) * SD::SECTOR_SIZE;
+}
+
+// 失敗した場合は内容を表示して false を返す (測定は打ち切る)
+bool CheckResult(SD::Result result)
+{
+	if (result != SD::Result::Ok) {
+		printf("[bench] Error: %s. Aborted.\n", SdDriver::GetResultName(result));
+		return false;
+	}
+	return true;
+}
+
+// CMD18 で sectors セクタを連続で読み出す (1 セクタを 1 操作とする)
+void RunSequentialRead(SdDriver *pDriver, uint32_t lba, uint32_t sectors)
+{
+	LatencyStats stats;
+
+	Stopwatch stopwatch;
+	if (!CheckResult(pDriver->BeginRead(lba))) {
+		return;
+	}
+	for (uint32_t i = 0; i < sectors; i++) {
+		uint32_t t0 = SdTimer::GetCycles();
+		SD::Result result = pDriver->NextSector(g_BenchBuffer);
+		stats.Add(SdTimer::GetCycles() - t0);
+		stopwatch.Update();
+		if (!CheckResult(result)) {
+			pDriver->EndRead();
+			return;
+		}
+	}
+	if (!CheckResult(pDriver->EndRead())) {
+		return;
+	}
+	uint64_t elapsed = stopwatch.GetElapsedCycles();
+
+	PrintResult("CMD18", GetBytes(sectors), elapsed, stats);
+}
+
+// CMD17 を sectors 回繰り返して連続領域を読み出す
+void RunSingleReadLoop(SdDriver *pDriver, uint32_t lba, uint32_t sectors)
+{
+	LatencyStats stats;
+
+	Stopwatch stopwatch;
+	for (uint32_t i = 0; i < sectors; i++) {
+		uint32_t t0 = SdTimer::GetCycles();
+		SD::Result result = pDriver->ReadSector(g_BenchBuffer, lba + i);
+		stats.Add(SdTimer::GetCycles() - t0);
+		stopwatch.Update();
+		if (!CheckResult(result)) {
+			return;
+		}
+	}
+	uint64_t elapsed = stopwatch.GetElapsedCycles();
+
+	PrintResult("CMD17", GetBytes(sectors), elapsed, stats);
+}
+
+// CMD25 で SD_BENCH_CHUNK_SECTORS セクタずつ書き込む (1 回の CMD25 を 1 操作とする)
+void RunSequentialWrite(SdDriver *pDriver, uint32_t lba, uint32_t sectors)
+{
+	LatencyStats stats;
+
+	Stopwatch stopwatch;
+	for (uint32_t done = 0; done < sectors; ) {
+		uint32_t count = sectors - done;
+		if (count > SD_BENCH_CHUNK_SECTORS) {
+			count = SD_BENCH_CHUNK_SECTORS;
+		}
+		uint32_t t0 = SdTimer::GetCycles();
+		SD::Result result = pDriver->WriteSector(g_BenchBuffer, lba + done, count);
+		stats.Add(SdTimer::GetCycles() - t0);
+		stopwatch.Update();
+		if (!CheckResult(result)) {
+			return;
+		}
+		done += count;
+	}
+	uint64_t elapsed = stopwatch.GetElapsedCycles();
+
+	PrintResult("CMD25", GetBytes(sectors), elapsed, stats);
+}
+
+// CPU を回して処理時間を模擬する (シミュレータでは __NOP() 1 回が 1 サイクル進む)
+void SpinMicroseconds(uint32_t us)
+{
+	const uint32_t cycles = us * (SystemCoreClock / 1000000);
+	const uint32_t start = SdTimer::GetCycles();
+	while ((SdTimer::GetCycles() - start) < cycles) {
+		__NOP();
+	}
+}
+
+// CMD18 で読みながら各セクタを処理する場合を、1 バッファ (NextSector) とダブルバッファ
+// (NextStreamSector) で比較する。処理は CRC16 の計算 (と workUs の空回り) で、結果が一致することも確認する。
+// ダブルバッファでは処理中に次のブロックを DMA で受信するので、DMA の通信路でのみ速くなる。
+void RunStream(SdDriver *pDriver, uint32_t lba, uint32_t sectors, uint32_t workUs)
+{
+	// 順序も確認できるよう、セクタ毎の CRC16 を順に畳み込む
+	uint32_t checksum[2] = { 0, 0 };
+
+	for (int pass = 0; pass < 2; pass++) {
+		const bool isDoubleBuffer = (pass == 1);
+		LatencyStats stats;
+
+		Stopwatch stopwatch;
+		SD::Result result = isDoubleBuffer ?
+			pDriver->BeginStream(lba, sectors, g_BenchBuffer) :
+			pDriver->BeginRead(lba);
+		if (!CheckResult(result)) {
+			return;
+		}
+		for (uint32_t i = 0; i < sectors; i++) {
+			uint32_t t0 = SdTimer::GetCycles();
+			const uint8_t *pSector = g_BenchBuffer;
+			result = isDoubleBuffer ?
+				pDriver->NextStreamSector(&pSector) :
+				pDriver->NextSector(g_BenchBuffer);
+			if (result == SD::Result::Ok) {
+				checksum[pass] = checksum[pass] * 31 + SD::GetCrc16(pSector, SD::SECTOR_SIZE);
+				SpinMicroseconds(workUs);
+			}
+			stats.Add(SdTimer::GetCycles() - t0);
+			stopwatch.Update();
+			if (!CheckResult(result)) {
+				if (isDoubleBuffer) {
+					pDriver->EndStream();
+				} else {
+					pDriver->EndRead();
+				}
+				return;
+			}
+		}
+		result = isDoubleBuffer ? pDriver->EndStream() : pDriver->EndRead();
+		if (!CheckResult(result)) {
+			return;
+		}
+		uint64_t elapsed = stopwatch.GetElapsedCycles();
+
+		PrintResult(isDoubleBuffer ? "Double" : "Single", GetBytes(sectors), elapsed, stats);
+	}
+
+	printf("  Checksum: 0x%08lX / 0x%08lX (%s)\n", checksum[0], checksum[1],
+		(checksum[0] == checksum[1]) ? "match" : "MISMATCH");
+}
+
+// RunChecksum() のコールバックの状態
+struct ChecksumContext {
+	uint32_t checksum;
+	uint32_t lastCycles;
+	LatencyStats stats;
+	Stopwatch stopwatch;
+};
+
+bool AddChecksum(void *pContext, uint32_t sectorIndex, const uint8_t *pSector)
+{
+	(void)sectorIndex;
+	ChecksumContext *pChecksum = static_cast<ChecksumContext*>(pContext);
+
+	// 前のセクタを渡し終えてからこのセクタが届くまでを 1 操作とする
+	uint32_t now = SdTimer::GetCycles();
+	pChecksum->stats.Add(now - pChecksum->lastCycles);
+	pChecksum->stopwatch.Update();
+
+	pChecksum->checksum = pChecksum->checksum * 31 + SD::GetCrc16(pSector, SD::SECTOR_SIZE);
+	pChecksum->lastCycles = SdTimer::GetCycles();
+	return true;
+}
+
+// ReadSectors() のコールバックで CRC16 を畳み込む (bench stream と同じチェックサムになる)
+void RunChecksum(SdDriver *pDriver, uint32_t lba, uint32_t sectors)
+{
+	ChecksumContext context;
+	context.checksum = 0;
+
+	context.lastCycles = SdTimer::GetCycles();
+	if (!CheckResult(pDriver->ReadSectors(lba, sectors, g_BenchBuffer, AddChecksum, &context))) {
+		return;
+	}
+	uint64_t elapsed = context.stopwatch.GetElapsedCycles();
+
+	PrintResult("Visit", GetBytes(sectors), elapsed, context.stats);
+	printf("  Checksum: 0x%08lX\n", context.checksum);
+}
+
+// 連続しないバッファへの読み書きを、セクタ毎の CMD17/CMD24 と ReadSectorsV()/WriteSectorsV() で比較する
+// SD_BENCH_CHUNK_SECTORS セクタを 1 操作とし、作業バッファのセクタを逆順に並べた一覧を使う。
+void RunScatterGather(SdDriver *pDriver, uint32_t lba, uint32_t sectors)
+{
+	uint8_t *pBuffers[SD_BENCH_CHUNK_SECTORS];
+	for (uint32_t i = 0; i < SD_BENCH_CHUNK_SECTORS; i++) {
+		pBuffers[i] = &g_BenchBuffer[(SD_BENCH_CHUNK_SECTORS - 1 - i) * SD::SECTOR_SIZE];
+	}
+
+	static const char *const Names[4] = { "CMD17", "ReadV", "CMD24", "WriteV" };
+	for (int pass = 0; pass < 4; pass++) {
+		const bool isWrite = (pass >= 2);
+		const bool isVector = ((pass % 2) == 1);
+		LatencyStats stats;
+
+		Stopwatch stopwatch;
+		for (uint32_t done = 0; done < sectors; ) {
+			uint32_t count = sectors - done;
+			if (count > SD_BENCH_CHUNK_SECTORS) {
+				count = SD_BENCH_CHUNK_SECTORS;
+			}
+			uint32_t t0 = SdTimer::GetCycles();
+			SD::Result result = SD::Result::Ok;
+			if (isVector) {
+				result = isWrite ?
+					pDriver->WriteSectorsV(pBuffers, lba + done, count) :
+					pDriver->ReadSectorsV(pBuffers, lba + done, count);
+			} else {
+				for (uint32_t i = 0; (i < count) && (result == SD::Result::Ok); i++) {
+					result = isWrite ?
+						pDriver->WriteSector(pBuffers[i], lba + done + i) :
+						pDriver->ReadSector(pBuffers[i], lba + done + i);
+				}
+			}
+			stats.Add(SdTimer::GetCycles() - t0);
+			stopwatch.Update();
+			if (!CheckResult(result)) {
+				return;
+			}
+			done += count;
+		}
+		uint64_t elapsed = stopwatch.GetElapsedCycles();
+
+		PrintResult(Names[pass], GetBytes(sectors), elapsed, stats);
+	}
+}
+
+// 1 セクタずつの連続読み出しを CMD17 で直接読む場合と先読み経由の場合で比較する
+void RunReadAhead(SdDriver *pDriver, uint32_t lba, uint32_t sectors)
+{
+	SdReadAhead *pReadAhead = pDriver->GetReadAhead();
+	if (pReadAhead == nullptr) {
+		printf("[bench] Error: Read-ahead is not available.\n");
+		return;
+	}
+
+	RunSingleReadLoop(pDriver, lba, sectors);
+
+	LatencyStats stats;
+	const SdReadAhead::Statistics before = pReadAhead->GetStatistics();
+
+	Stopwatch stopwatch;
+	for (uint32_t i = 0; i < sectors; i++) {
+		uint32_t t0 = SdTimer::GetCycles();
+		SD::Result result = pReadAhead->Read(g_BenchBuffer, lba + i);
+		stats.Add(SdTimer::GetCycles() - t0);
+		stopwatch.Update();
+		if (!CheckResult(result)) {
+			return;
+		}
+	}
+	uint64_t elapsed = stopwatch.GetElapsedCycles();
+
+	PrintResult("RA", GetBytes(sectors), elapsed, stats);
+
+	const SdReadAhead::Statistics &after = pReadAhead->GetStatistics();
+	printf("  Read-ahead: %lu hits, %lu misses, %lu prefetches, %lu wasted, depth %lu\n",
+		after.hitCount - before.hitCount,
+		after.missCount - before.missCount,
+		after.prefetchCount - before.prefetchCount,
+		after.wasteCount - before.wasteCount,
+		pReadAhead->GetDepth());
+}
+
+// 1 セクタずつの追記を CMD24 で直接書く場合とライトバックキャッシュ経由の場合で比較する
+// キャッシュ側の全体時間には最後の Sync() を含める。
+void RunLogWrite(SdDriver *pDriver, uint32_t lba, uint32_t sectors)
+{
+	SdWriteCache *pCache = pDriver->GetWriteCache();
+	if (pCache == nullptr) {
+		printf("[bench] Error: Write cache is not available.\n");
+		return;
+	}
+	if (!CheckResult(pCache->Sync())) {
+		return;
+	}
+
+	for (int pass = 0; pass < 2; pass++) {
+		const bool isCached = (pass == 1);
+		LatencyStats stats;
+
+		Stopwatch stopwatch;
+		for (uint32_t i = 0; i < sectors; i++) {
+			uint32_t t0 = SdTimer::GetCycles();
+			SD::Result result = isCached ?
+				pCache->Write(g_BenchBuffer, lba + i) :
+				pDriver->WriteSector(g_BenchBuffer, lba + i);
+			stats.Add(SdTimer::GetCycles() - t0);
+			stopwatch.Update();
+			if (!CheckResult(result)) {
+				return;
+			}
+		}
+		if (isCached && !CheckResult(pCache->Sync())) {
+			return;
+		}
+		uint64_t elapsed = stopwatch.GetElapsedCycles();
+
+		PrintResult(isCached ? "Cache" : "CMD24", GetBytes(sectors), elapsed, stats);
+	}
+}
+
+// [lba, lba + span) の範囲を CMD17/CMD24 で count 回ランダムに読み書きする
+void RunRandom(SdDriver *pDriver, uint32_t lba, uint32_t span, uint32_t count, bool isWrite)
+{
+	LatencyStats stats;
+	Random random;
+
+	Stopwatch stopwatch;
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t target = lba + (random.Next() % span);
+		uint32_t t0 = SdTimer::GetCycles();
+		SD::Result result;
+		if (isWrite) {
+			result = pDriver->WriteSector(g_BenchBuffer, target);
+		} else {
+			result = pDriver->ReadSector(g_BenchBuffer, target);
+		}
+		stats.Add(SdTimer::GetCycles() - t0);
+		stopwatch.Update();
+		if (!CheckResult(result)) {
+			return;
+		}
+	}
+	uint64_t elapsed = stopwatch.GetElapsedCycles();
+
+	PrintResult(isWrite ? "CMD24" : "CMD17", GetBytes(count), elapsed, stats);
+}
+
+// [lba, lba + span) の範囲のランダム読み出しを CMD17 とセクタキャッシュ経由で比較する
+// span をエントリ数程度にするとメタデータ (FAT など) の読み返しに近くなる。
+void RunSectorCache(SdDriver *pDriver, uint32_t lba, uint32_t span, uint32_t count)
+{
+	SdSectorCache *pCache = pDriver->GetSectorCache();
+	if (pCache == nullptr) {
+		printf("[bench] Error: Sector cache is not available.\n");
+		return;
+	}
+
+	RunRandom(pDriver, lba, span, count, false);
+
+	LatencyStats stats;
+	Random random;
+	const SdSectorCache::Statistics before = pCache->GetStatistics();
+
+	Stopwatch stopwatch;
+	for (uint32_t i = 0; i < count; i++) {
+		uint32_t target = lba + (random.Next() % span);
+		uint32_t t0 = SdTimer::GetCycles();
+		SD::Result result = pCache->Read(g_BenchBuffer, target);
+		stats.Add(SdTimer::GetCycles() - t0);
+		stopwatch.Update();
+		if (!CheckResult(result)) {
+			return;
+		}
+	}
+	uint64_t elapsed = stopwatch.GetElapsedCycles();
+
+	PrintResult("LRU", GetBytes(count), elapsed, stats);
+
+	const SdSectorCache::Statistics &after = pCache->GetStatistics();
+	printf("  Sector cache: %lu hits, %lu misses, %lu invalidated\n",
+		after.hitCount - before.hitCount,
+		after.missCount - before.missCount,
+		after.invalidateCount - before.invalidateCount);
+}
+
+/**
+ * 空白区切りの数値を最大 maxCount 個読み取る
+ * @return 読み取れた個数
+ */
+int ParseNumbers(const char *pArgs, uint32_t *pOutValues, int maxCount)
+{
+	int count = 0;
+	while (count < maxCount) {
+		char *pEnd;
+		uint32_t value = strtoul(pArgs, &pEnd, 0);
+		if (pEnd == pArgs) {
+			break;
+		}
+		pOutValues[count] = value;
+		count++;
+		pArgs = pEnd;
+	}
+	return count;
+}
+
+bool IsMode(const char *pMode, size_t length, const char *pName)
+{
+	return (length == strlen(pName)) && (strncmp(pMode, pName, length) == 0);
+}
+
+bool IsInRange(SdDriver *pDriver, uint32_t lba, uint32_t sectors)
+{
+	uint32_t sectorCount = pDriver->GetSectorCount();
+	return (sectors > 0) && (lba < sectorCount) && (sectors <= sectorCount - lba);
+}
+
+} // namespace
+
+namespace SdBench {
+
+void Run(SdDriver *pDriver, const char *pArgs)
+{
+	while (*pArgs == ' ') {
+		pArgs++;
+	}
+	const char *pMode = pArgs;
+	while ((*pArgs != ' ') && (*pArgs != '\0')) {
+		pArgs++;
+	}
+	size_t modeLength = pArgs - pMode;
+
+	uint32_t values[3];
+	int valueCount = ParseNumbers(pArgs, values, 3);
+
+	bool isSequential = IsMode(pMode, modeLength, "seqr") || IsMode(pMode, modeLength, "seqw") || IsMode(pMode, modeLength, "cmp") || IsMode(pMode, modeLength, "logw") || IsMode(pMode, modeLength, "ra") || IsMode(pMode, modeLength, "stream") || IsMode(pMode, modeLength, "sum") || IsMode(pMode, modeLength, "sg");
+	bool isRandom = IsMode(pMode, modeLength, "rndr") || IsMode(pMode, modeLength, "rndw") || IsMode(pMode, modeLength, "lru");
+	// stream は 3 つ目の値 (処理時間) を省略できる
+	bool hasOption = IsMode(pMode, modeLength, "stream") && (valueCount == 3);
+	if ((isSequential && (valueCount != 2) && !hasOption) || (isRandom && (valueCount != 3)) || (!isSequential && !isRandom)) {
+		PrintUsage();
+		return;
+	}
+
+	uint32_t lba = values[0];
+	uint32_t sectors = values[1];
+	uint32_t count = isRandom ? values[2] : sectors;
+	if (!IsInRange(pDriver, lba, sectors)) {
+		printf("[bench] Error: LBA range out of card (%lu sectors).\n", pDriver->GetSectorCount());
+		return;
+	}
+	if (isRandom && ((count == 0) || (count > MaxOperationCount))) {
+		printf("[bench] Error: Operation count must be 1-%lu.\n", MaxOperationCount);
+		return;
+	}
+
+	printf("[bench] %.*s LBA %lu-%lu, SPI %lu Hz, %s\n",
+		static_cast<int>(modeLength), pMode, lba, lba + sectors - 1, pDriver->GetSpiClock(),
+		pDriver->GetTransport()->GetName());
+
+	for (uint32_t i = 0; i < sizeof(g_BenchBuffer); i++) {
+		g_BenchBuffer[i] = static_cast<uint8_t>(i);
+	}
+
+	// 測定中にコンソール送信の DMA/割り込みが割り込まないよう出し切っておく
+	ConsoleFlush();
+	SdTimer::EnableCycleCounter();
+
+	if (IsMode(pMode, modeLength, "seqr")) {
+		RunSequentialRead(pDriver, lba, sectors);
+	} else if (IsMode(pMode, modeLength, "seqw")) {
+		RunSequentialWrite(pDriver, lba, sectors);
+	} else if (IsMode(pMode, modeLength, "rndr")) {
+		RunRandom(pDriver, lba, sectors, count, false);
+	} else if (IsMode(pMode, modeLength, "rndw")) {
+		RunRandom(pDriver, lba, sectors, count, true);
+	} else if (IsMode(pMode, modeLength, "logw")) {
+		RunLogWrite(pDriver, lba, sectors);
+	} else if (IsMode(pMode, modeLength, "ra")) {
+		RunReadAhead(pDriver, lba, sectors);
+	} else if (IsMode(pMode, modeLength, "lru")) {
+		RunSectorCache(pDriver, lba, sectors, count);
+	} else if (IsMode(pMode, modeLength, "stream")) {
+		RunStream(pDriver, lba, sectors, hasOption ? values[2] : 0);
+	} else if (IsMode(pMode, modeLength, "sum")) {
+		RunChecksum(pDriver, lba, sectors);
+	} else if (IsMode(pMode, modeLength, "sg")) {
+		RunScatterGather(pDriver, lba, sectors);
+	} else {
+		RunSingleReadLoop(pDriver, lba, sectors);
+		RunSequentialRead(pDriver, lba, sectors);
+	}
+}
+
+}
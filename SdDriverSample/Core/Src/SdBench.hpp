@@ -0,0 +1,33 @@
+#ifndef SD_BENCH_HPP
+#define SD_BENCH_HPP
+
+#include "SdDriver.hpp"
+
+// ----------------------------------------------------------------------
+//  実機ベンチマーク
+// ----------------------------------------------------------------------
+// REPL の "bench" コマンドから呼ばれる。
+// カードのロット比較や SPI クロック設定の確認をロジアナなしで行うためのもの。
+//
+//   bench seqr <lba> <sectors>        CMD18 による連続読み出し
+//   bench seqw <lba> <sectors>        CMD25 による連続書き込み
+//   bench rndr <lba> <span> <count>   CMD17 によるランダム読み出し
+//   bench rndw <lba> <span> <count>   CMD24 によるランダム書き込み
+//   bench cmp  <lba> <sectors>        CMD17 ループと CMD18 の比較
+//   bench logw <lba> <sectors>        1 セクタずつの追記を CMD24 とライトバックキャッシュで比較
+//   bench ra   <lba> <sectors>        1 セクタずつの連続読み出しを CMD17 と先読みで比較
+//   bench lru  <lba> <span> <count>   ランダム読み出しを CMD17 とセクタキャッシュで比較
+//   bench stream <lba> <sectors> [us] CMD18 で読みながらの処理を 1 バッファとダブルバッファで比較
+//                                     (us: CRC16 に加えてセクタ毎に CPU を回す時間)
+//   bench sum  <lba> <sectors>        ReadSectors() のコールバックでチェックサムを計算
+//   bench sg   <lba> <sectors>        連続しないバッファへの読み書きを CMD17/CMD24 と CMD18/CMD25 で比較
+//
+// 数値は strtoul() で解釈するので 0x 付きの 16 進数も使える。
+// 書き込み系は指定範囲のデータを破壊するので注意。
+namespace SdBench {
+
+void Run(SdDriver *pDriver, const char *pArgs);
+
+}
+
+#endif /* SD_BENCH_HPP */
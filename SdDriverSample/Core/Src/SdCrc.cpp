@@ -0,0 +1,68 @@
+#include "SdCrc.hpp"
+
+namespace {
+
+// 256 エントリのテーブルをコンパイル時に生成する
+template <typename T>
+struct CrcTable {
+	T value[256];
+};
+
+// CRC7 は 8 ビットの上位 7 ビットに詰めた状態で計算する
+// (生成多項式も 1 ビット左シフトして 0x09 << 1 = 0x12)
+constexpr CrcTable<uint8_t> MakeCrc7Table()
+{
+	CrcTable<uint8_t> table = {};
+	for (uint32_t i = 0; i < 256; i++) {
+		uint8_t crc = static_cast<uint8_t>(i);
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x80) ? static_cast<uint8_t>((crc << 1) ^ 0x12) : static_cast<uint8_t>(crc << 1);
+		}
+		table.value[i] = crc;
+	}
+	return table;
+}
+
+constexpr CrcTable<uint16_t> MakeCrc16Table()
+{
+	CrcTable<uint16_t> table = {};
+	for (uint32_t i = 0; i < 256; i++) {
+		uint16_t crc = static_cast<uint16_t>(i << 8);
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+		}
+		table.value[i] = crc;
+	}
+	return table;
+}
+
+constexpr CrcTable<uint8_t> g_Crc7Table = MakeCrc7Table();
+constexpr CrcTable<uint16_t> g_Crc16Table = MakeCrc16Table();
+
+// 1 の剰余は生成多項式そのものになる
+static_assert(g_Crc7Table.value[0x01] == 0x12, "CRC7 table is broken.");
+static_assert(g_Crc16Table.value[0x01] == 0x1021, "CRC16 table is broken.");
+
+} // namespace
+
+namespace SD {
+
+uint8_t GetCrc7(const uint8_t *pData, uint32_t size)
+{
+	uint8_t crc = 0;
+	for (uint32_t i = 0; i < size; i++) {
+		crc = g_Crc7Table.value[crc ^ pData[i]];
+	}
+	return crc >> 1;
+}
+
+uint16_t GetCrc16(const uint8_t *pData, uint32_t size)
+{
+	uint16_t crc = 0;
+	for (uint32_t i = 0; i < size; i++) {
+		crc = static_cast<uint16_t>((crc << 8) ^ g_Crc16Table.value[(crc >> 8) ^ pData[i]]);
+	}
+	return crc;
+}
+
+}
@@ -0,0 +1,28 @@
+#ifndef SD_CRC_HPP
+#define SD_CRC_HPP
+
+#include <cstdint>
+
+namespace SD {
+
+/**
+ * CRC7 (x^7 + x^3 + 1) を計算する
+ * コマンドと CID/CSD レジスタで使用される。
+ * @param pData 計算対象バッファ
+ * @param size 計算対象バッファのサイズ
+ * @return CRC (下位 7 ビット, コマンド送信時は 1 ビット左シフトして終端ビットを付けること)
+ */
+uint8_t GetCrc7(const uint8_t *pData, uint32_t size);
+
+/**
+ * CRC16-CCITT (x^16 + x^12 + x^5 + 1, 初期値 0) を計算する
+ * データパケットで使用される。
+ * @param pData 計算対象バッファ
+ * @param size 計算対象バッファのサイズ
+ * @return CRC
+ */
+uint16_t GetCrc16(const uint8_t *pData, uint32_t size);
+
+}
+
+#endif /* SD_CRC_HPP */
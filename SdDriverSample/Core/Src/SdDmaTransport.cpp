@@ -0,0 +1,184 @@
+#include "SdDmaTransport.hpp"
+#include "SdDriver.hpp"
+
+// ----------------------------------------------------------------------
+//  static private functions
+// ----------------------------------------------------------------------
+namespace {
+
+// HAL の SPI コールバックの通知先
+SdDmaTransport *g_pDmaOwner = nullptr;
+
+// 受信時に送信する 0xFF
+// 送信 DMA のメモリインクリメントを止めて、この 1 バイトを繰り返し送る。
+const uint8_t DummyByte = 0xFF;
+
+// STM32F303x8 の CCMRAM のサイズ
+constexpr uintptr_t CcmRamSize = 4 * 1024;
+
+// CCMRAM は CPU からしかアクセスできないので DMA の転送元/転送先にできない
+bool IsDmaAccessible(const void *pData)
+{
+	uintptr_t address = reinterpret_cast<uintptr_t>(pData);
+	return (address < CCMDATARAM_BASE) || (address >= CCMDATARAM_BASE + CcmRamSize);
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------
+//  HAL callbacks
+// ----------------------------------------------------------------------
+extern "C" void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	if (g_pDmaOwner != nullptr) {
+		g_pDmaOwner->OnTransferComplete(hspi, false);
+	}
+}
+
+extern "C" void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+	if (g_pDmaOwner != nullptr) {
+		g_pDmaOwner->OnTransferComplete(hspi, false);
+	}
+}
+
+extern "C" void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+	if (g_pDmaOwner != nullptr) {
+		g_pDmaOwner->OnTransferComplete(hspi, true);
+	}
+}
+
+// ----------------------------------------------------------------------
+//  class public methods
+// ----------------------------------------------------------------------
+SdDmaTransport::SdDmaTransport(SPI_HandleTypeDef *spi, GPIO_TypeDef *csPort, uint16_t csPin)
+	: SdRegisterTransport(spi, csPort, csPin)
+	, m_IsDmaBusy(false)
+	, m_IsDmaError(false)
+	, m_IsReceiving(false)
+	, m_pTransferCompleteCallback(nullptr)
+	, m_pTransferCompleteContext(nullptr)
+{
+	// CubeMX で SPI1_RX/SPI1_TX の DMA チャネルを設定しておくこと
+	ASSERT((spi->hdmarx != nullptr) && (spi->hdmatx != nullptr));
+
+	g_pDmaOwner = this;
+}
+
+const char *SdDmaTransport::GetName() const
+{
+	return "DMA";
+}
+
+void SdDmaTransport::Send(const uint8_t *pData, uint32_t size)
+{
+	if (size < SD_DMA_TRANSFER_MIN_SIZE) {
+		SdRegisterTransport::Send(pData, size);
+		return;
+	}
+	ASSERT(IsDmaAccessible(pData));
+
+	m_IsDmaError = false;
+	m_IsDmaBusy = true;
+	// HAL の API が const を受け付けないので外す (送信のみで書き換えられることはない)
+	if (HAL_SPI_Transmit_DMA(m_Spi, const_cast<uint8_t*>(pData), size) != HAL_OK) {
+		m_IsDmaBusy = false;
+		OnHalError();
+		return;
+	}
+	WaitComplete();
+}
+
+void SdDmaTransport::Receive(uint8_t *pOutData, uint32_t size)
+{
+	BeginReceive(pOutData, size);
+	EndReceive();
+}
+
+void SdDmaTransport::BeginReceive(uint8_t *pOutData, uint32_t size)
+{
+	ASSERT(!m_IsReceiving);
+	if (size < SD_DMA_TRANSFER_MIN_SIZE) {
+		SdRegisterTransport::Receive(pOutData, size);
+		return;
+	}
+	ASSERT(size <= UINT16_MAX);
+	ASSERT(IsDmaAccessible(pOutData));
+
+	// MINC はチャネル無効中にしか変更できない。
+	// F3 の HAL は転送完了時に割り込みを止めるだけで EN を落とさないので、自分で無効にしてから書き換える。
+	// HAL_DMA_Start_IT() は CCR の MINC を書き換えずにチャネルを有効にするので、転送の間だけ外しておけばよい。
+	__HAL_DMA_DISABLE(m_Spi->hdmatx);
+	CLEAR_BIT(m_Spi->hdmatx->Instance->CCR, DMA_CCR_MINC);
+
+	m_IsDmaError = false;
+	m_IsDmaBusy = true;
+	m_IsReceiving = true;
+	// HAL の API が const を受け付けないので外す (送信のみで書き換えられることはない)
+	// 開始できなかった場合も EndReceive() で MINC を戻す
+	if (HAL_SPI_TransmitReceive_DMA(m_Spi, const_cast<uint8_t*>(&DummyByte), pOutData, size) != HAL_OK) {
+		m_IsDmaBusy = false;
+		OnHalError();
+	}
+}
+
+void SdDmaTransport::EndReceive()
+{
+	if (!m_IsReceiving) {
+		return;
+	}
+	WaitComplete();
+
+	// 完了後も EN は立ったままなので、無効にしてから MINC を戻す
+	__HAL_DMA_DISABLE(m_Spi->hdmatx);
+	SET_BIT(m_Spi->hdmatx->Instance->CCR, DMA_CCR_MINC);
+	m_IsReceiving = false;
+}
+
+bool SdDmaTransport::IsBackgroundReceiveSupported() const
+{
+	return true;
+}
+
+void SdDmaTransport::SetTransferCompleteCallback(TransferCompleteCallback pCallback, void *pContext)
+{
+	m_pTransferCompleteCallback = pCallback;
+	m_pTransferCompleteContext = pContext;
+}
+
+void SdDmaTransport::OnTransferComplete(SPI_HandleTypeDef *spi, bool isError)
+{
+	if (spi != m_Spi) {
+		return;
+	}
+
+	m_IsDmaError = isError;
+	m_IsDmaBusy = false;
+
+	if (m_pTransferCompleteCallback != nullptr) {
+		m_pTransferCompleteCallback(m_pTransferCompleteContext);
+	}
+}
+
+// ----------------------------------------------------------------------
+//  class private methods
+// ----------------------------------------------------------------------
+// DMA 転送完了まで CPU をスリープさせて待つ
+void SdDmaTransport::WaitComplete()
+{
+	// 割り込み禁止中でも WFI は保留中の割り込みで復帰するので、
+	// フラグ確認から WFI までの間に完了割り込みが来ても取りこぼさない
+	__disable_irq();
+	while (m_IsDmaBusy) {
+		__WFI();
+		__enable_irq();
+		__disable_irq();
+	}
+	__enable_irq();
+
+	// 受信データは途中までしか書かれていない (SdDriver が TransportError にする)
+	if (m_IsDmaError) {
+		OnHalError();
+	}
+}
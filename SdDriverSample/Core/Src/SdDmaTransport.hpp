@@ -0,0 +1,59 @@
+#ifndef SD_DMA_TRANSPORT_HPP
+#define SD_DMA_TRANSPORT_HPP
+
+#include "SdRegisterTransport.hpp"
+
+// DMA を使う最小転送サイズ [byte]
+// これより短い転送 (コマンド、CRC など) は DMA の設定コストの方が大きいので
+// レジスタ直接操作のポーリングで行う。
+#ifndef SD_DMA_TRANSFER_MIN_SIZE
+#define SD_DMA_TRANSFER_MIN_SIZE	16
+#endif
+
+// ----------------------------------------------------------------------
+//  データブロックを DMA で転送する SPI 通信路
+// ----------------------------------------------------------------------
+// 転送中は CPU をスリープさせて割り込みに明け渡す。
+// BeginReceive() で受信を始めた場合は、EndReceive() で待つまで呼び出し側の処理を進められる。
+// 応答待ちなどの 1 バイト転送は SdRegisterTransport と同じ。
+// CubeMX で SPI1_RX/SPI1_TX の DMA チャネルを設定しておくこと。
+class SdDmaTransport : public SdRegisterTransport
+{
+public:
+	// DMA 転送完了コールバック
+	// 割り込みコンテキストから呼ばれるので重い処理はしないこと。
+	typedef void (*TransferCompleteCallback)(void *pContext);
+
+private:
+	// DMA 転送状態 (完了/エラー割り込みで更新される)
+	volatile bool m_IsDmaBusy;
+	volatile bool m_IsDmaError;
+
+	// BeginReceive() で DMA 受信を開始し、EndReceive() をまだ呼んでいない
+	bool m_IsReceiving;
+
+	// DMA 転送完了時のユーザーコールバック
+	TransferCompleteCallback m_pTransferCompleteCallback;
+	void *m_pTransferCompleteContext;
+
+public:
+	SdDmaTransport(SPI_HandleTypeDef *spi, GPIO_TypeDef *csPort, uint16_t csPin);
+
+	const char *GetName() const override;
+
+	void Send(const uint8_t *pData, uint32_t size) override;
+	void Receive(uint8_t *pOutData, uint32_t size) override;
+	void BeginReceive(uint8_t *pOutData, uint32_t size) override;
+	void EndReceive() override;
+	bool IsBackgroundReceiveSupported() const override;
+
+	void SetTransferCompleteCallback(TransferCompleteCallback pCallback, void *pContext);
+
+	// HAL の SPI 完了/エラーコールバックから呼ばれる
+	void OnTransferComplete(SPI_HandleTypeDef *spi, bool isError);
+
+private:
+	void WaitComplete();
+};
+
+#endif /* SD_DMA_TRANSPORT_HPP */
@@ -1,46 +1,106 @@
 #include "SdDriver.hpp"
+#include "SdCrc.hpp"
+#include "SdBench.hpp"
+#include "SdWriteCache.hpp"
+#include "SdReadAhead.hpp"
+#include "SdSectorCache.hpp"
 #include <cstring>
 #include <cctype>
+#include <cstdlib>
 
 // ----------------------------------------------------------------------
 //  static private functions
 // ----------------------------------------------------------------------
 namespace {
 
-void CsEnable()
+/**
+ * SD 用の CRC7 を取得する
+ * @param buf 長さ 5 の計算対象バッファ
+ * @return CRC (終端ビット付き)
+ */
+uint8_t GetSdCrc(const uint8_t *buf)
 {
-	HAL_GPIO_WritePin(SPI1_CS_GPIO_Port, SPI1_CS_Pin, GPIO_PIN_RESET);
+	return static_cast<uint8_t>((SD::GetCrc7(buf, 5) << 1) | 0x01);
 }
 
-void CsDisable()
+/**
+ * CSD の TRAN_SPEED から最大転送レートを求める
+ * @param tranSpeed TRAN_SPEED
+ * @return 最大転送レート [bit/s]
+ */
+uint32_t DecodeTranSpeed(uint8_t tranSpeed)
 {
-	HAL_GPIO_WritePin(SPI1_CS_GPIO_Port, SPI1_CS_Pin, GPIO_PIN_SET);
+	// 転送レート単位 (bit 2:0, 4 以降は予約)
+	static const uint32_t TransferRateUnits[8] = {
+		100000, 1000000, 10000000, 100000000, 0, 0, 0, 0,
+	};
+	// 時間値 (bit 6:3) の 10 倍 (0 は予約)
+	static const uint32_t TimeValues[16] = {
+		0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80,
+	};
+	return (TransferRateUnits[tranSpeed & 0x07] / 10) * TimeValues[(tranSpeed >> 3) & 0x0F];
 }
 
 /**
- * SD 用の CRC7 を取得する
- * @param buf 長さ 5 の計算対象バッファ
- * @return CRC
+ * CSD の TAAC からデータ読み出しアクセス時間を求める
+ * @param taac TAAC
+ * @return アクセス時間 [ns]
  */
-uint8_t GetSdCrc(const uint8_t *buf)
+uint32_t DecodeTaac(uint8_t taac)
 {
-	int crc;
-	int crc_prev;
+	// 時間単位 (bit 2:0)
+	static const uint32_t TimeUnits[8] = {
+		1, 10, 100, 1000, 10000, 100000, 1000000, 10000000,
+	};
+	// 時間値 (bit 6:3) の 10 倍 (0 は予約)
+	static const uint32_t TimeValues[16] = {
+		0, 10, 12, 13, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 80,
+	};
+	return (TimeUnits[taac & 0x07] * TimeValues[(taac >> 3) & 0x0F]) / 10;
+}
 
-	crc = buf[0];
-	for(int i = 1; i < 6; i++) {
-		for(int j = 7; j >= 0; j--) {
-			crc <<= 1;
-			crc_prev = crc;
-			if (i < 5) {
-				crc |= (buf[i] >> j) & 1;
-			}
-			if (crc & 0x80) {
-				crc ^= 0x89;	// Generator
-			}
-		}
+/**
+ * startTick から timeoutMs を超えて経過したか
+ * @param startTick 開始時の HAL_GetTick()
+ * @param timeoutMs タイムアウト [ms]
+ */
+bool IsTimedOut(uint32_t startTick, uint32_t timeoutMs)
+{
+	// 差分を取るので HAL_GetTick() が一周しても正しく判定できる
+	return (HAL_GetTick() - startTick) > timeoutMs;
+}
+
+/**
+ * データレスポンスを処理結果に変換する
+ * @param response データレスポンス
+ */
+SD::Result ToResult(uint8_t dataResponse)
+{
+	switch (static_cast<SD::DataResponse>(dataResponse & SD::DATA_RESPONSE_MASK)) {
+	case SD::DataResponse::Accepted:   return SD::Result::Ok;
+	case SD::DataResponse::CrcError:   return SD::Result::CrcError;
+	// 書き込みエラー以外 (データレスポンス自体が化けている) も書き込み失敗として扱う
+	default:                           return SD::Result::WriteError;
+	}
+}
+
+/**
+ * カードの一時的な不調で起こりうる (再試行で回復しうる) 失敗か
+ * 引数の誤りや未対応のカードなどは何度試しても同じ結果になる。
+ */
+bool IsRetryable(SD::Result result)
+{
+	switch (result) {
+	case SD::Result::Timeout:
+	case SD::Result::R1Error:
+	case SD::Result::CrcError:
+	case SD::Result::WriteError:
+	case SD::Result::DataError:
+	case SD::Result::TransportError:
+		return true;
+	default:
+		return false;
 	}
-	return (uint8_t)(crc_prev | 1);
 }
 
 void Hexdump(const uint8_t *buffer, uint32_t size)
@@ -153,12 +213,43 @@ const uint8_t g_TestWriteData2[] = {
 // ----------------------------------------------------------------------
 //  class public methods
 // ----------------------------------------------------------------------
-SdDriver::SdDriver(SPI_HandleTypeDef *spi)
-	: m_Spi(spi)
+const SdDriver::RetryPolicy SdDriver::DefaultRetryPolicy = {
+	/* maxRetryCount */ 2,
+	/* retryDelayMs  */ 1,
+};
+
+SdDriver::SdDriver(SdTransport *pTransport)
+	: m_pTransport(pTransport)
+	, m_pTransports()
+	, m_TransportCount(0)
 	, m_IsInitialized(false)
 	, m_SectorCount(0xFFFFFFFF)
+	, m_SpiClock(0)
+	, m_ReadTimeoutMs(SD::READ_TIMEOUT_MAX_MS)
+	, m_WriteTimeoutMs(SD::WRITE_TIMEOUT_SDXC_MS)
+	, m_EraseTimeoutMs(SD::ERASE_TIMEOUT_PER_AU_MS)
+	, m_CrcMode(CrcMode::Disabled)
+	, m_WriteBusyMode(WriteBusyMode::Immediate)
+	, m_BusyWaitMode(BusyWaitMode::Polling)
+	, m_CrcErrorCount(0)
+	, m_RetryPolicy(DefaultRetryPolicy)
+	, m_RetryCount(0)
+	, m_LastR1(0)
+	, m_TokenWaitCount(0)
+	, m_IsReading(false)
+	, m_pStreamBuffer(nullptr)
+	, m_StreamRemain(0)
+	, m_StreamFill(0)
+	, m_IsStreamReceiving(false)
+	, m_IsStreamHunting(false)
+	, m_IsStreamLatencyLong(false)
+	, m_StreamResult(SD::Result::Ok)
+	, m_pWriteCache(nullptr)
+	, m_pReadAhead(nullptr)
+	, m_pSectorCache(nullptr)
 {
-	std::memset(m_Dummy, 0xFF, SD::SECTOR_SIZE);
+	ASSERT(pTransport != nullptr);
+	AddTransport(pTransport);
 }
 
 SdDriver::~SdDriver()
@@ -167,58 +258,255 @@ SdDriver::~SdDriver()
 	ASSERT(0);
 }
 
-void SdDriver::Initialize()
+SD::Result SdDriver::Initialize()
 {
 	// 1ms 以上待つ (余裕をもって 10ms)
 	HAL_Delay(10);
 
+	// 初期化が完了するまでは 400kHz 以下で通信する
+	SetSpiClock(SD::IDENTIFICATION_CLOCK_MAX);
+
 	// 74 以上のダミークロック (余裕をもって 80 クロック == 10 バイト)
 	// (CS=Hi, DI=Hi)
-	CsDisable();
-	for (int i = 0; i < 10; i++) {
-		uint8_t dummy[1] = { 0xFF };
-		HAL_SPI_Transmit(m_Spi, dummy, 1, 0xFFFF);
-	}
+	m_pTransport->Deselect();
+	uint8_t dummy[10];
+	std::memset(dummy, 0xFF, sizeof(dummy));
+	m_pTransport->Send(dummy, sizeof(dummy));
 
 	// CMD0: SPI モードへの移行
-	IssueCommandGoIdleState();
+	SD::Result result = IssueCommandGoIdleState();
+	if (result != SD::Result::Ok) {
+		return result;
+	}
 	// CMD8: SD Ver 判定
-	IssueCommandSendIfCond();
+	result = IssueCommandSendIfCond();
+	if (result != SD::Result::Ok) {
+		return result;
+	}
 	// ACMD41: SD 初期化
-	IssueCommandAppSendOpCond();
+	result = IssueCommandAppSendOpCond();
+	if (result != SD::Result::Ok) {
+		SD_LOG_ERROR("[SD] Error: ACMD41 %s.\n", GetResultName(result));
+		return result;
+	}
 	// CMD58: アドレッシング確認
+	// (失敗した場合に OCR が 0 のままバイトアドレッシングと誤判定しないよう先に確認する)
 	SD::OCR ocr;
-	ReadRegister(&ocr);
+	result = ReadRegister(&ocr);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
 	// 2GB 以下の SD カードはバイトアドレッシング
 	if (ocr.CARD_CAPACITY_STATUS == 0) {
 		// CMD16: ブロック長の設定
-		IssueCommandSetBlocklen();
+		result = CheckR1(IssueCommandSetBlocklen());
+		if (result != SD::Result::Ok) {
+			return result;
+		}
 	
 		// TODO: バイトアドレッシングは面倒なので未対応
 		// (データ転送で *512 するだけではある)
-		ASSERT(0);
-		printf("[SD] Error: Byte Addressing is not supported.\n");
+		SD_LOG_ERROR("[SD] Error: Byte Addressing is not supported.\n");
+		return SD::Result::NotSupported;
 	}
 
 	// -- ここまでで初期化は完了 --
 
 	// CMD9: SD カードの容量取得
 	SD::CSD csd;
-	ReadRegister(&csd);
-	m_SectorCount = csd.C_SIZE * 1024;
-	printf("[SD] Sector Count: %lu\n", m_SectorCount);
+	result = ReadRegister(&csd);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+	// 容量 = (C_SIZE + 1) * 512KiB
+	m_SectorCount = (csd.C_SIZE + 1) * 1024;
+	SD_LOG_INFO("[SD] Sector Count: %lu\n", m_SectorCount);
 	// 容量 = セクタ総数 * 512 --> m_SectorCount * 512 / 1024 / 1024 / 1024 [GiB]
-	printf("[SD] SD Card Capacity: about %lu GiB\n", m_SectorCount / 2 / 1024 / 1024);
+	SD_LOG_INFO("[SD] SD Card Capacity: about %lu GiB\n", m_SectorCount / 2 / 1024 / 1024);
+
+	// SPI クロックをカードの最大転送レートまで上げる
+	uint32_t maxClock = DecodeTranSpeed(csd.TRAN_SPEED);
+	if ((maxClock == 0) || (maxClock > SD::DEFAULT_SPEED_CLOCK_MAX)) {
+		maxClock = SD::DEFAULT_SPEED_CLOCK_MAX;
+	}
+	SetSpiClock(maxClock);
+	SD_LOG_INFO("[SD] SPI Clock: %lu Hz (Card Max: %lu Hz)\n", m_SpiClock, maxClock);
+
+	// ACMD13: 消去時間の取得
+	SD::SSR ssr;
+	result = ReadRegister(&ssr);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+	UpdateTimeouts(csd, ssr);
 
 	m_IsInitialized = true;
+
+	return SD::Result::Ok;
+}
+
+void SdDriver::SetTransport(SdTransport *pTransport)
+{
+	ASSERT(pTransport != nullptr);
+	// 逐次読み出し中に切り替えないこと
+	ASSERT(m_IsReading == false);
+
+	m_pTransport = pTransport;
+	m_pTransport->Deselect();
+	// 初期化前は 0 なので Initialize() で設定される
+	if (m_SpiClock != 0) {
+		m_SpiClock = m_pTransport->SetClock(m_SpiClock);
+	}
+
+	// CRC 計算ユニットが無い通信路ではソフトウェア計算に切り替える
+	if ((m_CrcMode == CrcMode::Hardware) && !m_pTransport->IsHardwareCrcSupported()) {
+		SD_LOG_WARN("[SD] Warning: %s does not support hardware CRC. Using software CRC.\n", m_pTransport->GetName());
+		m_CrcMode = CrcMode::Software;
+	}
+
+	if ((m_BusyWaitMode == BusyWaitMode::Interrupt) && !m_pTransport->IsBusyInterruptSupported()) {
+		SD_LOG_WARN("[SD] Warning: %s does not support busy interrupt. Using polling.\n", m_pTransport->GetName());
+		m_BusyWaitMode = BusyWaitMode::Polling;
+	}
+}
+
+void SdDriver::AddTransport(SdTransport *pTransport)
+{
+	ASSERT(m_TransportCount < TRANSPORT_COUNT_MAX);
+	m_pTransports[m_TransportCount] = pTransport;
+	m_TransportCount++;
+}
+
+SD::Result SdDriver::SetCrcMode(CrcMode mode)
+{
+	// CMD59 自体にも正しい CRC7 が必要だが IssueCommand() で常に付けている
+	SD::Result result = CheckR1(IssueCommandCrcOnOff(mode != CrcMode::Disabled));
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	if ((mode == CrcMode::Hardware) && !m_pTransport->IsHardwareCrcSupported()) {
+		SD_LOG_WARN("[SD] Warning: %s does not support hardware CRC. Using software CRC.\n", m_pTransport->GetName());
+		mode = CrcMode::Software;
+	}
+	m_CrcMode = mode;
+
+	return SD::Result::Ok;
+}
+
+void SdDriver::SetRetryPolicy(const RetryPolicy &policy)
+{
+	m_RetryPolicy = policy;
+}
+
+void SdDriver::SetWriteBusyMode(WriteBusyMode mode)
+{
+	m_WriteBusyMode = mode;
+}
+
+void SdDriver::SetBusyWaitMode(BusyWaitMode mode)
+{
+	if ((mode == BusyWaitMode::Interrupt) && !m_pTransport->IsBusyInterruptSupported()) {
+		SD_LOG_WARN("[SD] Warning: %s does not support busy interrupt. Using polling.\n", m_pTransport->GetName());
+		mode = BusyWaitMode::Polling;
+	}
+	m_BusyWaitMode = mode;
+}
+
+void SdDriver::SetWriteCache(SdWriteCache *pWriteCache)
+{
+	m_pWriteCache = pWriteCache;
+}
+
+void SdDriver::SetReadAhead(SdReadAhead *pReadAhead)
+{
+	m_pReadAhead = pReadAhead;
+}
+
+void SdDriver::SetSectorCache(SdSectorCache *pSectorCache)
+{
+	m_pSectorCache = pSectorCache;
+}
+
+uint32_t SdDriver::GetSectorCount() const
+{
+	return m_SectorCount;
+}
+
+uint32_t SdDriver::GetSpiClock() const
+{
+	return m_SpiClock;
+}
+
+SdTransport *SdDriver::GetTransport() const
+{
+	return m_pTransport;
+}
+
+uint32_t SdDriver::GetRetryCount() const
+{
+	return m_RetryCount;
+}
+
+uint8_t SdDriver::GetLastR1() const
+{
+	return m_LastR1;
+}
+
+SdWriteCache *SdDriver::GetWriteCache() const
+{
+	return m_pWriteCache;
+}
+
+SdReadAhead *SdDriver::GetReadAhead() const
+{
+	return m_pReadAhead;
+}
+
+SdSectorCache *SdDriver::GetSectorCache() const
+{
+	return m_pSectorCache;
+}
+
+const char *SdDriver::GetResultName(SD::Result result)
+{
+	switch (result) {
+	case SD::Result::Ok:              return "Ok";
+	case SD::Result::Timeout:         return "Timeout";
+	case SD::Result::R1Error:         return "R1Error";
+	case SD::Result::CrcError:        return "CrcError";
+	case SD::Result::WriteError:      return "WriteError";
+	case SD::Result::DataError:       return "DataError";
+	case SD::Result::OutOfRange:      return "OutOfRange";
+	case SD::Result::InvalidArgument: return "InvalidArgument";
+	case SD::Result::InvalidState:    return "InvalidState";
+	case SD::Result::NotSupported:    return "NotSupported";
+	case SD::Result::TransportError:  return "TransportError";
+	default:                          return "Unknown";
+	}
+}
+
+void SdDriver::OnIdle()
+{
+	// 溜まっている書き込みがあれば先に書き出す
+	if ((m_pWriteCache != nullptr) && !m_IsReading) {
+		m_pWriteCache->OnIdle();
+	}
+
+	// 次の割り込み (UART 受信, SysTick など) まで眠る
+	__WFI();
 }
 
 void SdDriver::MainLoop()
 {
 	static uint8_t buffer[512];
+	SD::Result result = SD::Result::Ok;
 
-	SD::CID cid;
-	ReadRegister(&cid);
+	SD::CID cid = {};
+	result = ReadRegister(&cid);
+	if (result != SD::Result::Ok) {
+		printf("[SD] ReadRegister(CID): %s\n", GetResultName(result));
+	}
 
 	printf("CID ----------------------------------------\n");
 	printf("  MID  : %02X\n", cid.MID);
@@ -228,8 +516,11 @@ void SdDriver::MainLoop()
 	printf("  MDT  : %04X\n", cid.MDT);
 	printf("  CRC7 : %02X\n", cid.CRC7);
 
-	SD::CSD csd;
-	ReadRegister(&csd);
+	SD::CSD csd = {};
+	result = ReadRegister(&csd);
+	if (result != SD::Result::Ok) {
+		printf("[SD] ReadRegister(CSD): %s\n", GetResultName(result));
+	}
 
 	printf("CSD ----------------------------------------\n");
 	printf("  CSD_STRUCTURE      : %02X\n",  csd.CSD_STRUCTURE     );
@@ -257,8 +548,11 @@ void SdDriver::MainLoop()
 	printf("  FILE_FORMAT        : %02X\n",  csd.FILE_FORMAT       );
 	printf("  CRC7               : %02X\n",  csd.CRC7              );
 
-	SD::OCR ocr;
-	ReadRegister(&ocr);
+	SD::OCR ocr = {};
+	result = ReadRegister(&ocr);
+	if (result != SD::Result::Ok) {
+		printf("[SD] ReadRegister(OCR): %s\n", GetResultName(result));
+	}
 
 	printf("OCR ----------------------------------------\n");
 	printf("  Busy Flag    : %d (%s)\n", ocr.CARD_POWER_UP_STATUS_BIT, ((ocr.CARD_POWER_UP_STATUS_BIT == 1) ? "Busy" : "Free"));
@@ -285,8 +579,11 @@ void SdDriver::MainLoop()
 	printf("    1.8 - 1.7V : %d\n", ocr.VDD_VOLTAGE_WINDOW_18_17);
 	printf("    1.7 - 1.6V : %d\n", ocr.VDD_VOLTAGE_WINDOW_17_16);
 
-	SD::SCR scr;
-	ReadRegister(&scr);
+	SD::SCR scr = {};
+	result = ReadRegister(&scr);
+	if (result != SD::Result::Ok) {
+		printf("[SD] ReadRegister(SCR): %s\n", GetResultName(result));
+	}
 
 	printf("SCR ----------------------------------------\n");
 	printf("  SCR_STRUCTURE         : %02X\n", scr.SCR_STRUCTURE        );
@@ -299,8 +596,11 @@ void SdDriver::MainLoop()
 	printf("  SD_SPEC4              : %02X\n", scr.SD_SPEC4             );
 	printf("  CMD_SUPPORT           : %02X\n", scr.CMD_SUPPORT          );
 
-	SD::SSR ssr;
-	ReadRegister(&ssr);
+	SD::SSR ssr = {};
+	result = ReadRegister(&ssr);
+	if (result != SD::Result::Ok) {
+		printf("[SD] ReadRegister(SSR): %s\n", GetResultName(result));
+	}
 
 	printf("SSR ----------------------------------------\n");
     printf("  DAT_BUS_WIDTH          : %02X\n",  ssr.DAT_BUS_WIDTH         );
@@ -314,37 +614,66 @@ void SdDriver::MainLoop()
     printf("  ERASE_TIMEOUT          : %02X\n",  ssr.ERASE_TIMEOUT         );
     printf("  ERASE_OFFSET           : %02X\n",  ssr.ERASE_OFFSET          );
 
-	ReadSector(buffer, 0);
-	Hexdump(buffer, sizeof(buffer));
+	result = ReadSector(buffer, 0);
+	if (result == SD::Result::Ok) {
+		Hexdump(buffer, sizeof(buffer));
+	} else {
+		printf("[SD] ReadSector: %s\n", GetResultName(result));
+	}
 
 	// REPL
 	while (1) {
 		static uint8_t command[80];
-		memset(command, 0, sizeof(command));
 		int length = 0;
 		
 		printf("> ");
 		fflush(stdout);
 
-		length = ConsoleReadLine(command);
+		// 入力待ちの間もバックグラウンド処理を回す
+		while (!ConsoleIsLineAvailable()) {
+			OnIdle();
+		}
+		length = ConsoleReadLine(command, sizeof(command));
 		printf("Command : [%s]\n", command);
 		printf("Length  : %d\n", length);
 
 		if (strncmp((const char*)command, "w", 1) == 0) {
 			// TODO:
 			printf("Write Command\n");
-			WriteSector(g_TestWriteData2, 0);
+			result = WriteSector(g_TestWriteData2, 0);
+			if (result != SD::Result::Ok) {
+				printf("Error: %s\n", GetResultName(result));
+			}
+
+		} else if (strncmp((const char*)command, "retry", 5) == 0) {
+			// "r" より先に判定すること
+			// 再試行方針の表示/変更 ("retry <回数> [待ち時間 ms]")
+			const char *pArgs = reinterpret_cast<const char*>(&command[5]);
+			char *pEnd = nullptr;
+			uint32_t maxRetryCount = strtoul(pArgs, &pEnd, 0);
+			if (pEnd != pArgs) {
+				m_RetryPolicy.maxRetryCount = maxRetryCount;
+				pArgs = pEnd;
+				uint32_t retryDelayMs = strtoul(pArgs, &pEnd, 0);
+				if (pEnd != pArgs) {
+					m_RetryPolicy.retryDelayMs = retryDelayMs;
+				}
+			}
+			printf("Retry: max %lu, delay %lu ms (Retried %lu times)\n",
+				m_RetryPolicy.maxRetryCount, m_RetryPolicy.retryDelayMs, m_RetryCount);
 
 		} else if (strncmp((const char*)command, "r", 1) == 0) {
 			printf("Read Command\n");
 			// TODO: 引数で指定セクタを読み込めるようにする
-			printf("[0]");
-			ReadSector(buffer, 0);
-			Hexdump(buffer, sizeof(buffer));
-
-			printf("[1]");
-			ReadSector(buffer, 1);
-			Hexdump(buffer, sizeof(buffer));
+			for (uint32_t i = 0; i < 2; i++) {
+				printf("[%lu]", i);
+				result = ReadSector(buffer, i);
+				if (result != SD::Result::Ok) {
+					printf("Error: %s\n", GetResultName(result));
+					break;
+				}
+				Hexdump(buffer, sizeof(buffer));
+			}
 			/*
 			// Byte Addressing の SD カードの場合は 1-513 バイト目になる
 			// Block Addresssing の SD カードの場合は 513-1023 バイト目になる
@@ -356,12 +685,125 @@ void SdDriver::MainLoop()
 			printf("Multiple Read\n");
 			// TODO: 引数で指定セクタを読み込めるようにする
 			const int sectorCount = 2;
-			static uint8_t largeBuffer[SD::SECTOR_SIZE * sectorCount];
-			ReadSector(largeBuffer, 0, sectorCount);
-			Hexdump(largeBuffer, sizeof(largeBuffer));
+			result = BeginRead(0);
+			if (result != SD::Result::Ok) {
+				printf("Error: %s\n", GetResultName(result));
+				continue;
+			}
+			for (int i = 0; i < sectorCount; i++) {
+				printf("[%d]", i);
+				result = NextSector(buffer);
+				if (result != SD::Result::Ok) {
+					printf("Error: %s\n", GetResultName(result));
+					break;
+				}
+				Hexdump(buffer, sizeof(buffer));
+			}
+			result = EndRead();
+			if (result != SD::Result::Ok) {
+				printf("Error: %s\n", GetResultName(result));
+			}
+
+		} else if (strncmp((const char*)command, "sync", 4) == 0) {
+			// "s" より先に判定すること
+			if (m_pWriteCache == nullptr) {
+				printf("Write Cache: Not available\n");
+				continue;
+			}
+			result = m_pWriteCache->Sync();
+			if (result == SD::Result::Ok) {
+				result = WaitWriteComplete();
+			}
+			if (result != SD::Result::Ok) {
+				printf("Error: %s\n", GetResultName(result));
+			}
+			const SdWriteCache::Statistics &stats = m_pWriteCache->GetStatistics();
+			printf("Write Cache: %lu sectors written, %lu merged, %lu bypassed, %lu flushed in %lu commands (%lu dirty)\n",
+				stats.writeCount, stats.mergeCount, stats.bypassCount, stats.flushedCount, stats.commandCount,
+				m_pWriteCache->GetDirtyCount());
 
 		} else if (strncmp((const char*)command, "s", 1) == 0) {
 			IssueCommandGetStatus();
+
+		} else if (strncmp((const char*)command, "exti", 4) == 0) {
+			// Busy 解除の待ち方を ポーリング <-> MISO の EXTI 割り込み で切り替える
+			SetBusyWaitMode((m_BusyWaitMode == BusyWaitMode::Polling) ? BusyWaitMode::Interrupt : BusyWaitMode::Polling);
+			printf("Busy Wait: %s\n", (m_BusyWaitMode == BusyWaitMode::Polling) ? "Polling" : "Interrupt");
+
+		} else if (strncmp((const char*)command, "e", 1) == 0) {
+			// 1 セクタ消去 ("e <lba>")
+			// 打ち間違いで MBR などを消さないよう、LBA の指定が無ければ何もしない
+			const char *pArgs = reinterpret_cast<const char*>(&command[1]);
+			char *pEnd = nullptr;
+			uint32_t sectorIndex = strtoul(pArgs, &pEnd, 0);
+			if (pEnd == pArgs) {
+				printf("Usage: e <lba>\n");
+				continue;
+			}
+			printf("Erase Sector %lu\n", sectorIndex);
+			result = EraseSector(sectorIndex);
+			if (result != SD::Result::Ok) {
+				printf("Error: %s\n", GetResultName(result));
+			}
+
+		} else if (strncmp((const char*)command, "crc", 3) == 0) {
+			// データパケットの CRC 確認方式を 無効 -> ソフトウェア -> ハードウェア の順に切り替える
+			if (m_CrcMode == CrcMode::Disabled) {
+				result = SetCrcMode(CrcMode::Software);
+			} else if (m_CrcMode == CrcMode::Software) {
+				result = SetCrcMode(CrcMode::Hardware);
+			} else {
+				result = SetCrcMode(CrcMode::Disabled);
+			}
+			if (result != SD::Result::Ok) {
+				printf("Error: %s\n", GetResultName(result));
+			}
+			printf("CRC Mode: %s\n", (m_CrcMode == CrcMode::Disabled) ? "Disabled" : ((m_CrcMode == CrcMode::Software) ? "Software" : "Hardware"));
+			printf("CRC Error Count: %lu\n", m_CrcErrorCount);
+
+		} else if (strncmp((const char*)command, "busy", 4) == 0) {
+			// 書き込み後の Busy 待ちのタイミングを切り替える
+			if (m_WriteBusyMode == WriteBusyMode::Immediate) {
+				SetWriteBusyMode(WriteBusyMode::Deferred);
+			} else {
+				result = WaitWriteComplete();
+				if (result != SD::Result::Ok) {
+					printf("Error: %s\n", GetResultName(result));
+				}
+				SetWriteBusyMode(WriteBusyMode::Immediate);
+			}
+			printf("Write Busy: %s\n", (m_WriteBusyMode == WriteBusyMode::Immediate) ? "Immediate" : "Deferred");
+
+#ifdef SD_TRACE_ENABLE
+		} else if (strncmp((const char*)command, "trace", 5) == 0) {
+			SdTrace::Dump();
+			SdTrace::Clear();
+#endif
+
+#ifdef SD_PROFILE_ENABLE
+		} else if (strncmp((const char*)command, "prof", 4) == 0) {
+			SdProfile::Dump();
+			SdProfile::Clear();
+#endif
+
+		} else if (strncmp((const char*)command, "bench", 5) == 0) {
+			SdBench::Run(this, reinterpret_cast<const char*>(&command[5]));
+
+		} else if (strncmp((const char*)command, "transport", 9) == 0) {
+			// 通信路の一覧表示/切り替え ("transport <n>")
+			const char *pArgs = reinterpret_cast<const char*>(&command[9]);
+			char *pEnd = nullptr;
+			uint32_t index = strtoul(pArgs, &pEnd, 0);
+			if (pEnd != pArgs) {
+				if (index < m_TransportCount) {
+					SetTransport(m_pTransports[index]);
+				} else {
+					printf("Invalid transport %lu\n", index);
+				}
+			}
+			for (uint32_t i = 0; i < m_TransportCount; i++) {
+				printf("%c %lu: %s\n", (m_pTransports[i] == m_pTransport) ? '*' : ' ', i, m_pTransports[i]->GetName());
+			}
 		}
 	}
 }
@@ -369,9 +811,154 @@ void SdDriver::MainLoop()
 // ----------------------------------------------------------------------
 //  class private methods
 // ----------------------------------------------------------------------
+/**
+ * SPI クロックを指定クロック以下の最大値に設定する
+ * @param maxClock 最大クロック [Hz]
+ * @return 設定後のクロック [Hz]
+ */
+uint32_t SdDriver::SetSpiClock(uint32_t maxClock)
+{
+	m_SpiClock = m_pTransport->SetClock(maxClock);
+	return m_SpiClock;
+}
+
+/**
+ * CSD/SSR からタイムアウトを求める
+ * 読み出しは標準的なアクセス時間 (TAAC + NSAC * 100 クロック) の 100 倍、
+ * 書き込みはそれを R2W_FACTOR 倍したもので、どちらも仕様の上限で打ち切る。
+ * NSAC はクロック数なので、SPI クロックを上げた後に呼ぶこと。
+ */
+void SdDriver::UpdateTimeouts(const SD::CSD &csd, const SD::SSR &ssr)
+{
+	ASSERT(m_SpiClock != 0);
+
+	uint64_t accessNs = DecodeTaac(csd.TAAC) + (static_cast<uint64_t>(csd.NSAC) * 100 * 1000000000) / m_SpiClock;
+	uint32_t readMs = static_cast<uint32_t>((accessNs * 100 + 999999) / 1000000);
+	if (readMs == 0) {
+		readMs = 1;
+	} else if (readMs > SD::READ_TIMEOUT_MAX_MS) {
+		readMs = SD::READ_TIMEOUT_MAX_MS;
+	}
+
+	uint32_t writeMaxMs = (m_SectorCount >= SD::SDXC_SECTOR_COUNT_MIN) ? SD::WRITE_TIMEOUT_SDXC_MS : SD::WRITE_TIMEOUT_MAX_MS;
+	uint32_t writeMs = readMs << csd.R2W_FACTOR;
+	if (writeMs > writeMaxMs) {
+		writeMs = writeMaxMs;
+	}
+
+	// ERASE_SIZE 個の AU の消去に ERASE_TIMEOUT 秒かかり、
+	// 消去 1 回ごとに ERASE_OFFSET 秒が加わる (0 なら未対応なので 1 AU あたりの目安を使う)
+	uint32_t eraseMs = SD::ERASE_TIMEOUT_PER_AU_MS;
+	if ((ssr.ERASE_SIZE != 0) && (ssr.ERASE_TIMEOUT != 0)) {
+		eraseMs = (ssr.ERASE_TIMEOUT * 1000 + ssr.ERASE_SIZE - 1) / ssr.ERASE_SIZE + ssr.ERASE_OFFSET * 1000;
+	}
+
+	m_ReadTimeoutMs = readMs;
+	m_WriteTimeoutMs = writeMs;
+	m_EraseTimeoutMs = eraseMs;
+	SD_LOG_INFO("[SD] Timeout: Read %lu ms, Write %lu ms, Erase %lu ms\n", m_ReadTimeoutMs, m_WriteTimeoutMs, m_EraseTimeoutMs);
+}
+
+// セクタ API を呼べる状態か、[sectorIndex, sectorIndex + count) がカードに収まるか確認する
+SD::Result SdDriver::CheckRange(uint32_t sectorIndex, uint32_t count) const
+{
+	if (!m_IsInitialized || m_IsReading) {
+		return SD::Result::InvalidState;
+	}
+	if ((sectorIndex >= m_SectorCount) || (count > m_SectorCount - sectorIndex)) {
+		SD_LOG_ERROR("[SD] Error: Sector %lu (+%lu) is out of range (%lu).\n", sectorIndex, count, m_SectorCount);
+		return SD::Result::OutOfRange;
+	}
+	return SD::Result::Ok;
+}
+
+// 初期化完了後のコマンドの R1 を処理結果に変換する
+// (詳細は GetLastR1() で確認できるように残しておく)
+// R1 を受け取るまでの転送が失敗していれば R1 の値によらず TransportError にする
+SD::Result SdDriver::CheckR1(uint8_t r1Response)
+{
+	return CheckR1(r1Response, false);
+}
+
+// isIdleAllowed: 初期化中 (ACMD41 の完了前) でアイドル状態なのが正常な場合は true
+SD::Result SdDriver::CheckR1(uint8_t r1Response, bool isIdleAllowed)
+{
+	m_LastR1 = r1Response;
+	SD::Result result = CheckTransport();
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+	if (r1Response == SD::R1_NO_RESPONSE) {
+		return SD::Result::Timeout;
+	}
+	// 初期化完了後にアイドル状態が立っているのはカードがリセットされた場合
+	uint8_t errorBits = r1Response;
+	if (isIdleAllowed) {
+		errorBits &= static_cast<uint8_t>(~static_cast<uint8_t>(SD::R1ResponseFormat::InIdleState));
+	}
+	if (errorBits != 0x00) {
+		SD_LOG_ERROR("[SD] Error: R1 0x%02X.\n", r1Response);
+		return SD::Result::R1Error;
+	}
+	return SD::Result::Ok;
+}
+
+// 前回の確認以降に通信路で転送エラーが起きていれば TransportError を返す (エラーは消す)
+// 受信データや R1 は当てにならないので、転送の区切りごとにその内容より先に確認する
+SD::Result SdDriver::CheckTransport()
+{
+	if (!m_pTransport->HasError()) {
+		return SD::Result::Ok;
+	}
+	m_pTransport->ClearError();
+	SD_LOG_ERROR("[SD] Error: %s Transport Error.\n", m_pTransport->GetName());
+	return SD::Result::TransportError;
+}
+
+/**
+ * 失敗した処理を再試行すべきか判定し、再試行する場合は待ち時間だけ待つ
+ * @param result 処理結果
+ * @param pRetryCount 今回の処理での再試行回数 (再試行する場合は加算される)
+ * @return 再試行する場合は true
+ */
+bool SdDriver::ShouldRetry(SD::Result result, uint32_t *pRetryCount)
+{
+	if ((result == SD::Result::Ok) || !IsRetryable(result) || (*pRetryCount >= m_RetryPolicy.maxRetryCount)) {
+		return false;
+	}
+
+	(*pRetryCount)++;
+	m_RetryCount++;
+	SD_LOG_WARN("[SD] Warning: %s. Retrying (%lu/%lu).\n", GetResultName(result), *pRetryCount, m_RetryPolicy.maxRetryCount);
+
+	if (m_RetryPolicy.retryDelayMs != 0) {
+		HAL_Delay(m_RetryPolicy.retryDelayMs);
+	}
+	return true;
+}
+
 uint8_t SdDriver::IssueCommand(uint8_t command, uint32_t argument, SD::ResponseType responseType, void *pAdditionalResponse)
 {
-	CsEnable();
+	// 逐次読み出し中は EndRead() するまで他のコマンドは発行できない
+	ASSERT(m_IsReading == false);
+
+	SD_PROFILE_COMMAND(command);
+	SD_PROFILE_START(commandStart);
+
+	// 確認していない転送 (読み捨てたデータなど) のエラーをこのコマンドの結果にしない
+	m_pTransport->ClearError();
+	m_pTransport->Select();
+
+	// 前のコマンドの Busy が残っていれば解除を待つ
+	// (CMD0 はカードの状態が不明なため、CMD12 は読み出し中のデータと区別できないため除く)
+	if ((command != 0) && (command != 12)) {
+		// 転送エラーは通信路に残っているので CheckR1() で TransportError になる
+		if (WaitWhileBusy(m_WriteTimeoutMs) != SD::Result::Ok) {
+			m_pTransport->Deselect();
+			SD_LOG_ERROR("[SD] Error: CMD%d Busy Wait Failed.\n", command);
+			return SD::R1_NO_RESPONSE;
+		}
+	}
 
 	uint8_t txData[6];
 	// 01xxxxxx (x: CMDn, 初期化コマンドは CMD0)
@@ -380,10 +967,11 @@ uint8_t SdDriver::IssueCommand(uint8_t command, uint32_t argument, SD::ResponseT
 	txData[2] = (uint8_t)((argument & 0x00FF0000) >> 16);
 	txData[3] = (uint8_t)((argument & 0x0000FF00) >>  8);
 	txData[4] = (uint8_t)((argument & 0x000000FF) >>  0);
-	txData[5] = (uint8_t)GetSdCrc(txData);	// CMD0 以外は不要だが他のコマンドでもついでに計算
-	HAL_SPI_Transmit(m_Spi, txData, sizeof(txData), 0xFFFF);
+	txData[5] = (uint8_t)GetSdCrc(txData);	// CMD0/CMD8 と CRC 有効時 (CMD59) は必須
+	m_pTransport->Send(txData, sizeof(txData));
 
-	printf("[SD] CMD%d 0x%08lX\n", command, argument);
+	SD_LOG_DEBUG("[SD] CMD%d 0x%08lX\n", command, argument);
+	SD_TRACE(Command, command, argument);
 
 	uint8_t r1Response = 0;
 	uint8_t r2ErrorStatus = 0;
@@ -392,14 +980,16 @@ uint8_t SdDriver::IssueCommand(uint8_t command, uint32_t argument, SD::ResponseT
 	switch (responseType) {
 	case SD::ResponseType::R1:
 		r1Response = GetResponseR1();
-		printf("[SD] R1 0x%02X\n", r1Response);
+		SD_LOG_DEBUG("[SD] R1 0x%02X\n", r1Response);
+		SD_TRACE(Response, command, r1Response);
 		break;
 
 	case SD::ResponseType::R2:
 		ASSERT(pAdditionalResponse != nullptr);
 		r1Response = GetResponseR2(&r2ErrorStatus);
 		*reinterpret_cast<uint8_t*>(pAdditionalResponse) = r2ErrorStatus;
-		printf("[SD] R2 0x%02X 0x%02X\n", r1Response, r2ErrorStatus);
+		SD_LOG_DEBUG("[SD] R2 0x%02X 0x%02X\n", r1Response, r2ErrorStatus);
+		SD_TRACE(Response, command, (static_cast<uint32_t>(r2ErrorStatus) << 8) | r1Response);
 		break;
 
 	case SD::ResponseType::R3:
@@ -407,12 +997,14 @@ uint8_t SdDriver::IssueCommand(uint8_t command, uint32_t argument, SD::ResponseT
 		ASSERT(pAdditionalResponse != nullptr);
 		r1Response = GetResponseR3R7(&r3r7ReturnValue);
 		*reinterpret_cast<uint32_t*>(pAdditionalResponse) = r3r7ReturnValue;
-		printf("[SD] %s 0x%02X 0x%08lX\n", ((responseType == SD::ResponseType::R3) ? "R3" : "R7"), r1Response, r3r7ReturnValue);
+		SD_LOG_DEBUG("[SD] %s 0x%02X 0x%08lX\n", ((responseType == SD::ResponseType::R3) ? "R3" : "R7"), r1Response, r3r7ReturnValue);
+		SD_TRACE(Response, command, (r3r7ReturnValue << 8) | r1Response);
 		break;
 
 	case SD::ResponseType::R1b:
 		r1Response = GetResponseR1b();
-		printf("[SD] R1b 0x%02X\n", r1Response);
+		SD_LOG_DEBUG("[SD] R1b 0x%02X\n", r1Response);
+		SD_TRACE(Response, command, r1Response);
 		break;
 
 	default:
@@ -421,7 +1013,9 @@ uint8_t SdDriver::IssueCommand(uint8_t command, uint32_t argument, SD::ResponseT
 		break;
 	}
 
-	CsDisable();
+	m_pTransport->Deselect();
+
+	SD_PROFILE_RECORD(Command, commandStart);
 
 	return r1Response;
 }
@@ -432,42 +1026,58 @@ uint8_t SdDriver::IssueCommand(uint8_t command, uint32_t argument, SD::ResponseT
 }
 
 // CMD0 + アイドル状態確認
-void SdDriver::IssueCommandGoIdleState()
+SD::Result SdDriver::IssueCommandGoIdleState()
 {
 	uint8_t response = IssueCommand(0, 0x00000000, SD::ResponseType::R1);
+	m_LastR1 = response;
+	SD::Result result = CheckTransport();
+	if (result != SD::Result::Ok) {
+		return result;
+	}
 	if (response != static_cast<uint8_t>(SD::R1ResponseFormat::InIdleState)) {
-		printf("[SD] Error: CMD0 Resp is not InIdleState.\n");
-		ASSERT(0);
+		SD_LOG_ERROR("[SD] Error: CMD0 Resp is not InIdleState.\n");
+		return (response == SD::R1_NO_RESPONSE) ? SD::Result::Timeout : SD::Result::R1Error;
 	}
+	return SD::Result::Ok;
 }
 
 // CMD8 + SD Version 確認 (要 ver.2)
-void SdDriver::IssueCommandSendIfCond()
+SD::Result SdDriver::IssueCommandSendIfCond()
 {
 	uint32_t returnValue = 0;
-	IssueCommand(8, 0x000001AA, SD::ResponseType::R7, &returnValue);
+	uint8_t response = IssueCommand(8, 0x000001AA, SD::ResponseType::R7, &returnValue);
+	m_LastR1 = response;
+	SD::Result result = CheckTransport();
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+	if (response == SD::R1_NO_RESPONSE) {
+		return SD::Result::Timeout;
+	}
+	// Ver.1 のカードは CMD8 を Illegal Command にする
 	if ((returnValue & 0x000003FF) != 0x000001AA) {
-		printf("[SD] Error: SD Version must be 2.\n");
-		ASSERT(0);
+		SD_LOG_ERROR("[SD] Error: SD Version must be 2.\n");
+		return SD::Result::NotSupported;
 	}
+	return SD::Result::Ok;
 }
 
 // CMD9
-void SdDriver::IssueCommandSendCsd()
+uint8_t SdDriver::IssueCommandSendCsd()
 {
-	IssueCommand(9, 0x00000000, SD::ResponseType::R1);
+	return IssueCommand(9, 0x00000000, SD::ResponseType::R1);
 }
 
 // CMD10
-void SdDriver::IssueCommandSendCid()
+uint8_t SdDriver::IssueCommandSendCid()
 {
-	IssueCommand(10, 0x00000000, SD::ResponseType::R1);
+	return IssueCommand(10, 0x00000000, SD::ResponseType::R1);
 }
 
-// CMD12
-void SdDriver::IssueCommandStopTransmission()
+// CMD12 (Busy 解除は待たない)
+uint8_t SdDriver::IssueCommandStopTransmission()
 {
-	IssueCommand(12, 0x00000000, SD::ResponseType::R1b);
+	return IssueCommand(12, 0x00000000, SD::ResponseType::R1b);
 }
 
 // CMD13 + エラー確認
@@ -480,137 +1090,165 @@ void SdDriver::IssueCommandGetStatus()
 }
 
 // CMD16
-void SdDriver::IssueCommandSetBlocklen()
+uint8_t SdDriver::IssueCommandSetBlocklen()
 {
 	// ブロック・サイズを 512 バイトに設定
-	IssueCommand(16, 0x00000200, SD::ResponseType::R1);
+	return IssueCommand(16, 0x00000200, SD::ResponseType::R1);
 }
 
 // CMD17
-void SdDriver::IssueCommandReadSingleBlock(uint32_t sectorIndex)
+uint8_t SdDriver::IssueCommandReadSingleBlock(uint32_t sectorIndex)
 {
-	IssueCommand(17, sectorIndex, SD::ResponseType::R1);
+	return IssueCommand(17, sectorIndex, SD::ResponseType::R1);
 }
 
 // CMD18
-void SdDriver::IssueCommandReadMultipleBlock(uint32_t sectorIndex)
+uint8_t SdDriver::IssueCommandReadMultipleBlock(uint32_t sectorIndex)
 {
-	IssueCommand(18, sectorIndex, SD::ResponseType::R1);
+	return IssueCommand(18, sectorIndex, SD::ResponseType::R1);
 }
 
 // CMD24
-void SdDriver::IssueCommandWriteSingleBlock(uint32_t sectorIndex)
+uint8_t SdDriver::IssueCommandWriteSingleBlock(uint32_t sectorIndex)
 {
-	IssueCommand(24, sectorIndex, SD::ResponseType::R1);
+	return IssueCommand(24, sectorIndex, SD::ResponseType::R1);
 }
 
 // CMD25
-void SdDriver::IssueCommandWriteMultipleBlock(uint32_t sectorIndex)
+uint8_t SdDriver::IssueCommandWriteMultipleBlock(uint32_t sectorIndex)
+{
+	return IssueCommand(25, sectorIndex, SD::ResponseType::R1);
+}
+
+// CMD32
+uint8_t SdDriver::IssueCommandEraseWrBlkStart(uint32_t sectorIndex)
+{
+	return IssueCommand(32, sectorIndex, SD::ResponseType::R1);
+}
+
+// CMD33
+uint8_t SdDriver::IssueCommandEraseWrBlkEnd(uint32_t sectorIndex)
+{
+	return IssueCommand(33, sectorIndex, SD::ResponseType::R1);
+}
+
+// CMD38 (Busy 解除は待たない)
+uint8_t SdDriver::IssueCommandErase()
 {
-	IssueCommand(25, sectorIndex, SD::ResponseType::R1);
+	return IssueCommand(38, 0x00000000, SD::ResponseType::R1b);
 }
 
 // CMD55 (ACMDn 用)
-void SdDriver::IssueCommandAppCmd()
+uint8_t SdDriver::IssueCommandAppCmd()
+{
+	return IssueCommand(55, 0x00000000, SD::ResponseType::R1);
+}
+
+// CMD55 + ACMDn
+// CMD55 が受け付けられなければ ACMD は送らずに CMD55 の R1 を返す
+// (次のコマンドで転送エラーが消されるので、CMD55 の転送エラーもここで止める)
+uint8_t SdDriver::IssueAppCommand(uint8_t command, uint32_t argument)
+{
+	uint8_t response = IssueCommandAppCmd();
+	if (((response & ~static_cast<uint8_t>(SD::R1ResponseFormat::InIdleState)) != 0x00) || m_pTransport->HasError()) {
+		SD_LOG_ERROR("[SD] Error: CMD55 for ACMD%d Failed (R1 0x%02X).\n", command, response);
+		return response;
+	}
+	return IssueCommand(command, argument, SD::ResponseType::R1);
+}
+
+// CMD59
+uint8_t SdDriver::IssueCommandCrcOnOff(bool isEnabled)
 {
-	IssueCommand(55, 0x00000000, SD::ResponseType::R1);
+	return IssueCommand(59, (isEnabled ? 0x00000001 : 0x00000000), SD::ResponseType::R1);
 }
 
 // CMD58
-void SdDriver::IssueCommandReadOcr(uint32_t *pOutOcr)
+uint8_t SdDriver::IssueCommandReadOcr(uint32_t *pOutOcr)
 {
 	uint32_t ocr = 0;
-	IssueCommand(58, 0x00000000, SD::ResponseType::R3, &ocr);
+	uint8_t response = IssueCommand(58, 0x00000000, SD::ResponseType::R3, &ocr);
 	ASSERT(pOutOcr != nullptr);
 	*pOutOcr = ocr;
+	return response;
 }
 
 // ACMD13
-void SdDriver::IssueCommandSdStatus()
+uint8_t SdDriver::IssueCommandSdStatus()
 {
-	IssueCommandAppCmd();
-	IssueCommand(13, 0x40000000, SD::ResponseType::R1);
+	return IssueAppCommand(13, 0x40000000);
 }
 
 // ACMD41 + 初期化完了確認
-void SdDriver::IssueCommandAppSendOpCond()
+SD::Result SdDriver::IssueCommandAppSendOpCond()
 {
+	const uint32_t startTick = HAL_GetTick();
 	uint8_t response = 0xFF;
 	// 最大で 1 秒程度かかる
 	while (response != 0x00) {
-		IssueCommandAppCmd();
-		response = IssueCommand(41, 0x40000000, SD::ResponseType::R1);
+		if (IsTimedOut(startTick, SD::INIT_TIMEOUT_MS)) {
+			return SD::Result::Timeout;
+		}
+		// 完了するまではアイドル状態 (0x01) が返る。それ以外のエラービットや無応答は待っても変わらない
+		response = IssueAppCommand(41, 0x40000000);
+		SD::Result result = CheckR1(response, true);
+		if (result != SD::Result::Ok) {
+			return result;
+		}
 		// TODO: 初期化確認ループ周期の決定
 		HAL_Delay(10);
 	}
+	return SD::Result::Ok;
 }
 
 // ACMD51
-void SdDriver::IssueCommandSendScr()
+uint8_t SdDriver::IssueCommandSendScr()
 {
-	IssueCommandAppCmd();
-	IssueCommand(51, 0x40000000, SD::ResponseType::R1);
+	return IssueAppCommand(51, 0x40000000);
 }
 
 uint8_t SdDriver::GetResponseR1()
 {
-	uint8_t txData[1] = { 0xFF };	// Dummy
-	uint8_t rxData[1];
+	uint8_t response = 0xFF;
 	bool responseOk = false;
 
+	SD_PROFILE_START(responseStart);
+
 	// 8 バイト以内に応答があるはず
 	for (int i = 0; i < 8; i++) {
-		HAL_SPI_TransmitReceive(m_Spi, txData, rxData, sizeof(rxData), 0xFFFF);
-		if ((rxData[0] & 0x80) == 0x00) {
+		response = m_pTransport->Exchange(0xFF);
+		if ((response & 0x80) == 0x00) {
 			responseOk = true;
 			break;
 		}
 	}
-	ASSERT(responseOk == true);
+	SD_PROFILE_RECORD(Response, responseStart);
+	if (!responseOk) {
+		SD_LOG_ERROR("[SD] Error: R1 Timeout.\n");
+		return SD::R1_NO_RESPONSE;
+	}
 
 	// TODO: R1 の内容確認
 	
-	return rxData[0];
+	return response;
 }
 
+// Busy 解除は待たないので、呼び出し側で WaitReady() すること
+// (Busy 時間はコマンドによって大きく異なり、タイムアウトも異なるため)
 uint8_t SdDriver::GetResponseR1b()
 {
-	uint8_t txData[1] = { 0xFF, };	// Dummy
-	uint8_t rxData[1];
-
 	// CMD12 では 1 バイト分空読みが必要
 	// TODO: 他の R1b コマンドを試していないので CMD12 のみの特別対応なのか要調査
-	HAL_SPI_TransmitReceive(m_Spi, txData, rxData, sizeof(rxData), 0xFFFF);
-
-	uint8_t r1Response = GetResponseR1();
-
-	// DEBUG: Busy 待ち回数カウンタ。デバッグ用
-	int busyCount = 0;
-
-	// Busy 解除待ち
-	// Busy の間は DO ラインが Lo 固定になっている
-	while (1) {
-		HAL_SPI_TransmitReceive(m_Spi, txData, rxData, sizeof(rxData), 0xFFFF);
-		if (rxData[0] != 0x00) {
-			break;
-		}
-		busyCount++;
-	}
+	m_pTransport->Exchange(0xFF);
 
-	// DEBUG:
-	printf("[SD] R1b BusyCount %d\n", busyCount);
-
-	return r1Response;
+	return GetResponseR1();
 }
 
 uint8_t SdDriver::GetResponseR2(uint8_t *pOutErrorStatus)
 {
 	uint8_t r1Response = GetResponseR1();
 
-	uint8_t txData[1] = { 0xFF, };	// Dummy
-	uint8_t rxData[1];
-	HAL_SPI_TransmitReceive(m_Spi, txData, rxData, sizeof(rxData), 0xFFFF);
-	*pOutErrorStatus = rxData[0];
+	*pOutErrorStatus = m_pTransport->Exchange(0xFF);
 
 	return r1Response;
 }
@@ -619,9 +1257,8 @@ uint8_t SdDriver::GetResponseR3R7(uint32_t *pOutReturnValue)
 {
 	uint8_t r1Response = GetResponseR1();
 
-	uint8_t txData[4] = { 0xFF, 0xFF, 0xFF, 0xFF, };	// Dummy
 	uint8_t rxData[4];
-	HAL_SPI_TransmitReceive(m_Spi, txData, rxData, sizeof(rxData), 0xFFFF);
+	m_pTransport->Receive(rxData, sizeof(rxData));
 
 	*pOutReturnValue = (((uint32_t)rxData[0] << 24) |
 				    	((uint32_t)rxData[1] << 16) |
@@ -632,154 +1269,799 @@ uint8_t SdDriver::GetResponseR3R7(uint32_t *pOutReturnValue)
 
 // R1 系の後に 0xFF が来るまで待つ
 // ブロック書き込みの完了で使用?
-// TODO: マルチブロック系でも使用?
+// データレスポンスを読み込む
+// この後カードは書き込みを終えるまで Busy になる (待つのは呼び出し側)
+// CS を Lo にした状態で呼ぶこと
 uint8_t SdDriver::GetDataResponse()
 {
-	CsEnable();
+	// CRC の直後にデータレスポンスが来る
+	return m_pTransport->Exchange(0xFF);
+}
 
-	uint8_t txData[1] = { 0xFF };	// Dummy
-	uint8_t rxData[1];
+// Busy の間は DO ラインが Lo 固定になっているので 0xFF が来るまで待つ
+// CS を Lo にした状態で呼ぶこと
+SD::Result SdDriver::WaitWhileBusy(uint32_t timeoutMs)
+{
+	SD_PROFILE_START(busyStart);
 
-	// 最初に R1 が来る
-	HAL_SPI_TransmitReceive(m_Spi, txData, rxData, sizeof(rxData), 0xFFFF);
-	uint8_t response = rxData[0];
+	// Busy 待ち回数カウンタ。ログ/トレース用
+	// (BusyWaitMode::Interrupt では割り込みで起きてから読み直した回数になる)
+	uint32_t busyCount = 0;
+	SD::Result result = SD::Result::Ok;
 
-	// 0xFF が来るまで待つ
-	while (1) {
-		HAL_SPI_TransmitReceive(m_Spi, txData, rxData, sizeof(rxData), 0xFFFF);
-		if (rxData[0] == 0xFF) {
+	const uint32_t startTick = HAL_GetTick();
+	while (m_pTransport->Exchange(0xFF) != 0xFF) {
+		busyCount++;
+		if (IsTimedOut(startTick, timeoutMs)) {
+			SD_LOG_ERROR("[SD] Error: Busy Timeout (%lu ms).\n", timeoutMs);
+			result = SD::Result::Timeout;
 			break;
 		}
+		if (m_BusyWaitMode == BusyWaitMode::Interrupt) {
+			// 残り時間だけ眠る (タイムアウトしても次の 0xFF の確認で判定する)
+			// IsTimedOut() の後に SysTick が進んでいることがあるので、残りが無ければ眠らない
+			// (引き算が負に回り込むと 49 日眠ることになる)
+			uint32_t elapsedMs = HAL_GetTick() - startTick;
+			uint32_t remainMs = (elapsedMs >= timeoutMs) ? 0 : (timeoutMs - elapsedMs);
+			if (remainMs > 0) {
+				m_pTransport->WaitBusyInterrupt(remainMs);
+			}
+		}
 	}
 
-	CsDisable();
+	// 転送エラーで 0xFF が返った場合は Ready とはみなさない
+	// (エラーは消さないので、呼び出し側の CheckR1()/CheckTransport() でも検出される)
+	if ((result == SD::Result::Ok) && m_pTransport->HasError()) {
+		result = SD::Result::TransportError;
+	}
 
-	return response;
+	// 始めから Ready だった場合 (コマンド発行前の確認など) は記録しない
+	if (busyCount > 0) {
+		SD_PROFILE_RECORD(Busy, busyStart);
+		SD_LOG_DEBUG("[SD] BusyCount %lu\n", busyCount);
+		SD_TRACE(BusyCount, 0, busyCount);
+	}
+
+	return result;
 }
 
-void SdDriver::ReadSector(uint8_t *pOutBuffer, uint32_t sectorIndex)
+SD::Result SdDriver::WaitReady(uint32_t timeoutMs)
 {
-	ASSERT(pOutBuffer != nullptr);
+	m_pTransport->Select();
+	SD::Result result = WaitWhileBusy(timeoutMs);
+	m_pTransport->Deselect();
 
-	IssueCommandReadSingleBlock(sectorIndex);
+	return result;
+}
 
-	// データパケット読み込み
-	CsEnable();
-	while (1) {
-		uint8_t txData[1] = { 0xFF };
-		uint8_t rxData[1];
-		HAL_SPI_TransmitReceive(m_Spi, txData, rxData, 1, 0xFFFF);
-		if (rxData[0] == SD::DATA_START_TOKEN_EXCEPT_CMD25) {
-			break;
-		}
+// CS を Lo にした状態で呼ぶこと
+SD::Result SdDriver::ReceiveDataPacket(uint8_t *pOutBuffer, uint32_t size)
+{
+	SD::Result result = WaitDataStartToken();
+	if (result != SD::Result::Ok) {
+		return result;
 	}
 
-	// HAL_SPI_Receive() だと 0xFF 以外のデータが送信されてしまうので
-	// HAL_SPI_TransmitReceive() を使用する必要がある
-	HAL_SPI_TransmitReceive(m_Spi, m_Dummy, pOutBuffer, SD::SECTOR_SIZE, 0xFFFF);
+	SD_PROFILE_START(dataStart);
 
-	// データパケットに CRC が含まれているので読み込むが確認はしない
-	uint8_t crc[2];
-	HAL_SPI_TransmitReceive(m_Spi, m_Dummy, crc, sizeof(crc), 0xFFFF);
+	BeginReceiveData(pOutBuffer, size);
+	result = EndReceiveData(pOutBuffer, size);
 
-	// MEMO:
-	// CMD17 の場合はデータパケットを受信完了すると自動的に
-	// data ステートから tran ステートに戻るみたいなので CMD12 (転送完了) は不要
+	SD_PROFILE_RECORD(Data, dataStart);
 
-	CsDisable();
+	return result;
 }
 
-void SdDriver::ReadSector(uint8_t *pOutBuffer, uint32_t sectorIndex, uint32_t blockNum)
+SD::Result SdDriver::WaitDataStartToken()
 {
-	ASSERT(pOutBuffer != nullptr);
+	SD_PROFILE_START(tokenStart);
+
+	const uint32_t startTick = HAL_GetTick();
+	uint8_t token;
+	m_TokenWaitCount = 0;
+	while ((token = m_pTransport->Exchange(0xFF)) != SD::DATA_START_TOKEN_EXCEPT_CMD25) {
+		m_TokenWaitCount++;
+		SD::Result result = CheckDataErrorToken(token);
+		if (result != SD::Result::Ok) {
+			return result;
+		}
+		// 転送エラーでは 0xFF が返り続けるのでタイムアウトまで待たない
+		if (m_pTransport->HasError()) {
+			return CheckTransport();
+		}
+		if (IsTimedOut(startTick, m_ReadTimeoutMs)) {
+			SD_LOG_ERROR("[SD] Error: Data Start Token Timeout (%lu ms).\n", m_ReadTimeoutMs);
+			return SD::Result::Timeout;
+		}
+	}
 
-	// TODO: シングルセクタリードとの共有 (削除)
+	SD_PROFILE_RECORD(Token, tokenStart);
 
-	IssueCommandReadMultipleBlock(sectorIndex);
+	return SD::Result::Ok;
+}
 
-	// データパケット読み込み
-	CsEnable();
-	for (uint32_t i = 0; i < blockNum; i++) {
-		while (1) {
-			uint8_t txData[1] = { 0xFF };
-			uint8_t rxData[1];
-			HAL_SPI_TransmitReceive(m_Spi, txData, rxData, 1, 0xFFFF);
-			if (rxData[0] == SD::DATA_START_TOKEN_EXCEPT_CMD25) {
-				break;
-			}
+SD::Result SdDriver::CheckDataErrorToken(uint8_t token)
+{
+	// データエラートークン (0000xxxx) が来た場合はデータパケットは来ない
+	if (((token & SD::DATA_ERROR_TOKEN_MASK) == 0x00) && (token != 0x00)) {
+		SD_LOG_ERROR("[SD] Error: Data Error Token 0x%02X.\n", token);
+		if ((token & static_cast<uint8_t>(SD::DataErrorToken::OutOfRange)) != 0) {
+			return SD::Result::OutOfRange;
 		}
+		return SD::Result::DataError;
+	}
+	return SD::Result::Ok;
+}
+
+void SdDriver::BeginReceiveData(uint8_t *pOutBuffer, uint32_t size)
+{
+	if (m_CrcMode == CrcMode::Hardware) {
+		m_pTransport->BeginHardwareCrc();
+	}
+	m_pTransport->BeginReceive(pOutBuffer, size);
+}
+
+SD::Result SdDriver::EndReceiveData(const uint8_t *pBuffer, uint32_t size)
+{
+	m_pTransport->EndReceive();
+
+	uint16_t calculatedCrc = 0;
+	if (m_CrcMode == CrcMode::Hardware) {
+		// CRC 部を受信する前に受信データの CRC を取り出しておく
+		calculatedCrc = m_pTransport->EndHardwareCrc(true);
+	} else if (m_CrcMode == CrcMode::Software) {
+		calculatedCrc = SD::GetCrc16(pBuffer, size);
+	}
 
-		// HAL_SPI_Receive() だと 0xFF 以外のデータが送信されてしまうので
-		// HAL_SPI_TransmitReceive() を使用する必要がある
-		HAL_SPI_TransmitReceive(m_Spi, m_Dummy, &pOutBuffer[i * SD::SECTOR_SIZE], SD::SECTOR_SIZE, 0xFFFF);
+	// データパケットの CRC (CRC が無効の場合は読み捨てる)
+	uint8_t crc[2];
+	m_pTransport->Receive(crc, sizeof(crc));
 
-		// データパケットに CRC が含まれているので読み込むが確認はしない
-		uint8_t crc[2];
-		HAL_SPI_TransmitReceive(m_Spi, m_Dummy, crc, sizeof(crc), 0xFFFF);
+	// データ自体が受信できていなければ CRC を比べても意味が無い
+	SD::Result result = CheckTransport();
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	if (m_CrcMode != CrcMode::Disabled) {
+		uint16_t receivedCrc = static_cast<uint16_t>((crc[0] << 8) | crc[1]);
+		if (receivedCrc != calculatedCrc) {
+			m_CrcErrorCount++;
+			SD_LOG_ERROR("[SD] Error: Data CRC Mismatch (Received 0x%04X, Calculated 0x%04X).\n", receivedCrc, calculatedCrc);
+			SD_TRACE(CrcError, 0, (static_cast<uint32_t>(receivedCrc) << 16) | calculatedCrc);
+			return SD::Result::CrcError;
+		}
 	}
-	CsDisable();
 
-	IssueCommandStopTransmission();
+	return SD::Result::Ok;
 }
 
-void SdDriver::WriteSector(const uint8_t *pBuffer, uint32_t sectorIndex)
+// データレスポンスを返す (書き込み完了は待たない)
+// CS を Lo にした状態で呼ぶこと
+uint8_t SdDriver::TransmitDataPacket(uint8_t token, const uint8_t *pBuffer)
 {
-	ASSERT(pBuffer != nullptr);
+	SD_PROFILE_START(dataStart);
 
-	IssueCommandWriteSingleBlock(sectorIndex);
+	// 1 バイト以上空ける必要がある
+	// [データ開始トークン][書き込みデータ (512)][CRC (2)]
+	uint8_t header[2] = { 0xFF, token };
+	m_pTransport->Send(header, sizeof(header));
+
+	uint16_t calculatedCrc = 0;
+	if (m_CrcMode == CrcMode::Hardware) {
+		m_pTransport->BeginHardwareCrc();
+		m_pTransport->Send(pBuffer, SD::SECTOR_SIZE);
+		calculatedCrc = m_pTransport->EndHardwareCrc(false);
+	} else {
+		if (m_CrcMode == CrcMode::Software) {
+			calculatedCrc = SD::GetCrc16(pBuffer, SD::SECTOR_SIZE);
+		}
+		m_pTransport->Send(pBuffer, SD::SECTOR_SIZE);
+	}
 
-	// MEMO: セクタ読み込みと同じ方式
-	// TODO: データパケット読み込みの共通化
-	// データパケット読み込み
-	CsEnable();
+	// CRC は CMD59 で有効にしない限り確認されないのでその場合はダミーを送る
+	uint8_t crc[2] = { 0xFF, 0xFF };
+	if (m_CrcMode != CrcMode::Disabled) {
+		crc[0] = static_cast<uint8_t>(calculatedCrc >> 8);
+		crc[1] = static_cast<uint8_t>(calculatedCrc >> 0);
+	}
+	m_pTransport->Send(crc, sizeof(crc));
 
-	// 1 バイト以上空ける必要がある
-	uint8_t txData;
-	txData = 0xFF;
-	HAL_SPI_Transmit(m_Spi, &txData, 1, 0xFFFF);
+	SD_PROFILE_RECORD(Data, dataStart);
 
-	// [データ開始トークン][書き込みデータ (512)][CRC (2)]
-	txData = SD::DATA_START_TOKEN_EXCEPT_CMD25;
-	HAL_SPI_Transmit(m_Spi, &txData, 1, 0xFFFF);
+	return GetDataResponse();
+}
+
+// 送信に失敗したデータパケットの残りを 0xFF で埋める
+// 転送が途中で止まるとカードは残りのデータを待ち続け、次のコマンドもデータとして読まれてしまう。
+// 1 パケット分以上送れば必ず受信を終えてデータレスポンスを返す
+// (送信できていた場合は Busy か次の開始トークン待ちなので 0xFF は無視される)。
+// CRC が無効だと 0xFF で埋めたデータも書き込まれるが、再試行で書き直される。
+void SdDriver::PadDataPacket()
+{
+	uint8_t dummy[16];
+	for (uint32_t i = 0; i < SD::SECTOR_SIZE + 2; i += sizeof(dummy)) {
+		m_pTransport->Receive(dummy, sizeof(dummy));
+	}
+	// ここでの転送エラーは元のエラーとして報告済み
+	m_pTransport->ClearError();
+}
 
-	HAL_SPI_Transmit(m_Spi, (uint8_t*)pBuffer, SD::SECTOR_SIZE, 0xFFFF);
+SD::Result SdDriver::ReadSector(uint8_t *pOutBuffer, uint32_t sectorIndex)
+{
+	if (pOutBuffer == nullptr) {
+		return SD::Result::InvalidArgument;
+	}
+	SD::Result result = CheckRange(sectorIndex, 1);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
 
-	uint8_t crc[2] = { 0x00, 0x00 };
-	HAL_SPI_TransmitReceive(m_Spi, m_Dummy, crc, sizeof(crc), 0xFFFF);
+	uint32_t retryCount = 0;
+	do {
+		result = ReadSingleBlock(pOutBuffer, sectorIndex);
+	} while (ShouldRetry(result, &retryCount));
 
-	uint8_t response = GetDataResponse();
-	printf("[SD] Data Response: 0x%02X\n", response);
+	return result;
+}
+
+SD::Result SdDriver::ReadSector(uint8_t *pOutBuffer, uint32_t sectorIndex, uint32_t blockNum)
+{
+	if (pOutBuffer == nullptr) {
+		return SD::Result::InvalidArgument;
+	}
+	SD::Result result = CheckRange(sectorIndex, blockNum);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
 
-	CsDisable();
+	uint32_t retryCount = 0;
+	do {
+		result = ReadMultipleBlock(pOutBuffer, nullptr, sectorIndex, blockNum);
+	} while (ShouldRetry(result, &retryCount));
+
+	return result;
 }
 
-void SdDriver::EraseSector(uint32_t sectorIndex)
+// 逐次読み出しは途中から再試行できないので、失敗した場合は呼び出し側で EndRead() して読み直すこと
+SD::Result SdDriver::BeginRead(uint32_t sectorIndex)
 {
-	// TODO: Not Implemented
-	printf("[SD] Error: Not implemented.\n");
-	ASSERT(0);
+	SD::Result result = CheckRange(sectorIndex, 1);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	result = CheckR1(IssueCommandReadMultipleBlock(sectorIndex));
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	// EndRead() まで CS は Lo のままにしておく
+	m_pTransport->Select();
+	m_IsReading = true;
+
+	return SD::Result::Ok;
+}
+
+SD::Result SdDriver::NextSector(uint8_t *pOutBuffer)
+{
+	if (pOutBuffer == nullptr) {
+		return SD::Result::InvalidArgument;
+	}
+	if (!m_IsReading || (m_pStreamBuffer != nullptr)) {
+		return SD::Result::InvalidState;
+	}
+
+	// カードは CMD12 を受けるまで次のデータパケットを送り続ける
+	// (最終セクタを超えると Out of Range のデータエラートークンが来る)
+	return ReceiveDataPacket(pOutBuffer, SD::SECTOR_SIZE);
+}
+
+SD::Result SdDriver::EndRead()
+{
+	if (!m_IsReading || (m_pStreamBuffer != nullptr)) {
+		return SD::Result::InvalidState;
+	}
+
+	m_pTransport->Deselect();
+	m_IsReading = false;
+
+	SD::Result result = CheckR1(IssueCommandStopTransmission());
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+	return WaitReady(m_WriteTimeoutMs);
+}
+
+SD::Result SdDriver::BeginStream(uint32_t sectorIndex, uint32_t count, uint8_t *pDoubleBuffer)
+{
+	if ((pDoubleBuffer == nullptr) || (count == 0)) {
+		return SD::Result::InvalidArgument;
+	}
+	SD::Result result = CheckRange(sectorIndex, count);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	result = BeginRead(sectorIndex);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	m_pStreamBuffer = pDoubleBuffer;
+	m_StreamRemain = count;
+	m_StreamFill = 0;
+	m_IsStreamReceiving = false;
+	m_IsStreamHunting = false;
+	m_StreamResult = StartStreamBlock();
+	if (m_StreamResult != SD::Result::Ok) {
+		// 1 ブロック目から来ない場合は開けなかったことにする
+		result = m_StreamResult;
+		EndStream();
+		return result;
+	}
+	// 1 ブロック目の待ち時間は CMD18 のアクセス時間なので、ブロック間の準備時間とはみなさない
+	m_IsStreamLatencyLong = false;
+
+	return SD::Result::Ok;
+}
+
+SD::Result SdDriver::NextStreamSector(const uint8_t **ppOutSector)
+{
+	if (ppOutSector == nullptr) {
+		return SD::Result::InvalidArgument;
+	}
+	if (m_pStreamBuffer == nullptr) {
+		return SD::Result::InvalidState;
+	}
+	if (!m_IsStreamReceiving) {
+		// 受信を始められなかったか、BeginStream() で指定した範囲を読み終えた
+		if ((m_StreamResult != SD::Result::Ok) || (m_StreamRemain == 0)) {
+			return (m_StreamResult != SD::Result::Ok) ? m_StreamResult : SD::Result::OutOfRange;
+		}
+		// 裏で受信できない通信路は、前回の処理中にカードの準備が進むようここで開始トークンを待つ
+		m_StreamResult = StartStreamBlock();
+		if (m_StreamResult != SD::Result::Ok) {
+			return m_StreamResult;
+		}
+	}
+
+	uint8_t *pReceived = &m_pStreamBuffer[m_StreamFill * SD::SECTOR_SIZE];
+	m_IsStreamReceiving = false;
+	if (m_IsStreamHunting) {
+		m_IsStreamHunting = false;
+		m_StreamResult = EndHuntStreamBlock(pReceived);
+	} else {
+		m_StreamResult = EndReceiveData(pReceived, SD::SECTOR_SIZE);
+	}
+	if (m_StreamResult != SD::Result::Ok) {
+		return m_StreamResult;
+	}
+
+	// 呼び出し側がこのセクタを処理している間に、前回渡したバッファへ次のブロックを受信する
+	// カードの準備が長い場合は、開始トークンを待つ時間も処理と重なるようトークンを待たずに始める
+	// (ハードウェア CRC はトークンの前の 0xFF も計算してしまうので除く)。
+	m_StreamFill ^= 1;
+	if ((m_StreamRemain > 0) && m_pTransport->IsBackgroundReceiveSupported()) {
+		if (m_IsStreamLatencyLong && (m_CrcMode != CrcMode::Hardware)) {
+			HuntStreamBlock();
+		} else {
+			m_StreamResult = StartStreamBlock();
+		}
+	}
+
+	*ppOutSector = pReceived;
+	return SD::Result::Ok;
+}
+
+SD::Result SdDriver::EndStream()
+{
+	if (m_pStreamBuffer == nullptr) {
+		return SD::Result::InvalidState;
+	}
+
+	if (m_IsStreamReceiving) {
+		// 途中で閉じる場合は受信中のブロックを読み捨てる (CMD12 の前に受信を終えておく)
+		m_pTransport->EndReceive();
+		if ((m_CrcMode == CrcMode::Hardware) && !m_IsStreamHunting) {
+			m_pTransport->EndHardwareCrc(true);
+		}
+		m_IsStreamReceiving = false;
+		m_IsStreamHunting = false;
+	}
+	m_pStreamBuffer = nullptr;
+
+	return EndRead();
+}
+
+SD::Result SdDriver::ReadSectors(uint32_t sectorIndex, uint32_t count, uint8_t *pDoubleBuffer, SectorCallback pCallback, void *pContext)
+{
+	if ((pDoubleBuffer == nullptr) || (pCallback == nullptr)) {
+		return SD::Result::InvalidArgument;
+	}
+	SD::Result result = CheckRange(sectorIndex, count);
+	if ((result != SD::Result::Ok) || (count == 0)) {
+		return result;
+	}
+
+	uint32_t doneCount = 0;
+	bool isStopped = false;
+	uint32_t retryCount = 0;
+	do {
+		result = ReadMultipleBlock(sectorIndex + doneCount, count - doneCount, pDoubleBuffer, pCallback, pContext, &doneCount, &isStopped);
+	} while (!isStopped && ShouldRetry(result, &retryCount));
+
+	return result;
+}
+
+SD::Result SdDriver::WriteSector(const uint8_t *pBuffer, uint32_t sectorIndex)
+{
+	if (pBuffer == nullptr) {
+		return SD::Result::InvalidArgument;
+	}
+	SD::Result result = CheckRange(sectorIndex, 1);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	InvalidateCaches(sectorIndex, 1);
+
+	uint32_t retryCount = 0;
+	do {
+		result = WriteSingleBlock(pBuffer, sectorIndex);
+	} while (ShouldRetry(result, &retryCount));
+
+	return result;
+}
+
+SD::Result SdDriver::WriteSector(const uint8_t *pBuffer, uint32_t sectorIndex, uint32_t count)
+{
+	if (pBuffer == nullptr) {
+		return SD::Result::InvalidArgument;
+	}
+	SD::Result result = CheckRange(sectorIndex, count);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	InvalidateCaches(sectorIndex, count);
+
+	// 書き込みは同じ内容を書き直すだけなので、途中で失敗しても先頭からやり直してよい
+	uint32_t retryCount = 0;
+	do {
+		result = WriteMultipleBlock(pBuffer, nullptr, sectorIndex, count);
+	} while (ShouldRetry(result, &retryCount));
+
+	return result;
+}
+
+SD::Result SdDriver::EraseSector(uint32_t sectorIndex)
+{
+	SD::Result result = CheckRange(sectorIndex, 1);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	InvalidateCaches(sectorIndex, 1);
+
+	uint32_t retryCount = 0;
+	do {
+		result = EraseBlock(sectorIndex);
+	} while (ShouldRetry(result, &retryCount));
+
+	return result;
+}
+
+SD::Result SdDriver::WaitWriteComplete()
+{
+	if (!m_IsInitialized || m_IsReading) {
+		return SD::Result::InvalidState;
+	}
+	return WaitReady(m_WriteTimeoutMs);
+}
+
+SD::Result SdDriver::ReadSectorsV(uint8_t *const *ppOutBuffers, uint32_t sectorIndex, uint32_t count)
+{
+	if (ppOutBuffers == nullptr) {
+		return SD::Result::InvalidArgument;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		if (ppOutBuffers[i] == nullptr) {
+			return SD::Result::InvalidArgument;
+		}
+	}
+	SD::Result result = CheckRange(sectorIndex, count);
+	if ((result != SD::Result::Ok) || (count == 0)) {
+		return result;
+	}
+
+	uint32_t retryCount = 0;
+	do {
+		result = ReadMultipleBlock(nullptr, ppOutBuffers, sectorIndex, count);
+	} while (ShouldRetry(result, &retryCount));
+
+	return result;
+}
+
+SD::Result SdDriver::WriteSectorsV(const uint8_t *const *ppBuffers, uint32_t sectorIndex, uint32_t count)
+{
+	if (ppBuffers == nullptr) {
+		return SD::Result::InvalidArgument;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		if (ppBuffers[i] == nullptr) {
+			return SD::Result::InvalidArgument;
+		}
+	}
+	SD::Result result = CheckRange(sectorIndex, count);
+	if ((result != SD::Result::Ok) || (count == 0)) {
+		return result;
+	}
+
+	InvalidateCaches(sectorIndex, count);
+
+	uint32_t retryCount = 0;
+	do {
+		result = WriteMultipleBlock(nullptr, ppBuffers, sectorIndex, count);
+	} while (ShouldRetry(result, &retryCount));
+
+	return result;
+}
+
+void SdDriver::InvalidateCaches(uint32_t sectorIndex, uint32_t count)
+{
+	// 書き込みが失敗しても途中まで書き換わっている可能性があるので、書き込む前に破棄する
+	if (m_pReadAhead != nullptr) {
+		m_pReadAhead->Invalidate(sectorIndex, count);
+	}
+	if (m_pSectorCache != nullptr) {
+		m_pSectorCache->Invalidate(sectorIndex, count);
+	}
 }
 
-void SdDriver::ReadRegister(SD::CID *pOutRegister)
+// ----------------------------------------------------------------------
+//  class private methods (sector I/O)
+// ----------------------------------------------------------------------
+SD::Result SdDriver::ReadSingleBlock(uint8_t *pOutBuffer, uint32_t sectorIndex)
 {
-	IssueCommandSendCid();
+	SD::Result result = CheckR1(IssueCommandReadSingleBlock(sectorIndex));
+	if (result != SD::Result::Ok) {
+		return result;
+	}
 
-	// MEMO: セクタ読み込みと同じ方式
-	// TODO: データパケット読み込みの共通化
 	// データパケット読み込み
-	CsEnable();
-	while (1) {
-		uint8_t txData[1] = { 0xFF };
-		uint8_t rxData[1];
-		HAL_SPI_TransmitReceive(m_Spi, txData, rxData, 1, 0xFFFF);
-		if (rxData[0] == SD::DATA_START_TOKEN_EXCEPT_CMD25) {
+	m_pTransport->Select();
+	result = ReceiveDataPacket(pOutBuffer, SD::SECTOR_SIZE);
+
+	// MEMO:
+	// CMD17 の場合はデータパケットを受信完了すると自動的に
+	// data ステートから tran ステートに戻るみたいなので CMD12 (転送完了) は不要
+
+	m_pTransport->Deselect();
+
+	return result;
+}
+
+SD::Result SdDriver::ReadMultipleBlock(uint8_t *pOutBuffer, uint8_t *const *ppOutBuffers, uint32_t sectorIndex, uint32_t blockNum)
+{
+	SD::Result result = BeginRead(sectorIndex);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+	for (uint32_t i = 0; i < blockNum; i++) {
+		result = NextSector((ppOutBuffers != nullptr) ? ppOutBuffers[i] : &pOutBuffer[i * SD::SECTOR_SIZE]);
+		if (result != SD::Result::Ok) {
+			break;
+		}
+	}
+	// 途中で失敗してもストリームは閉じる
+	SD::Result endResult = EndRead();
+
+	return (result != SD::Result::Ok) ? result : endResult;
+}
+
+SD::Result SdDriver::ReadMultipleBlock(uint32_t sectorIndex, uint32_t count, uint8_t *pDoubleBuffer, SectorCallback pCallback, void *pContext, uint32_t *pOutDoneCount, bool *pOutIsStopped)
+{
+	SD::Result result = BeginStream(sectorIndex, count, pDoubleBuffer);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+	for (uint32_t i = 0; i < count; i++) {
+		const uint8_t *pSector;
+		result = NextStreamSector(&pSector);
+		if (result != SD::Result::Ok) {
+			break;
+		}
+		(*pOutDoneCount)++;
+		if (!pCallback(pContext, sectorIndex + i, pSector)) {
+			*pOutIsStopped = true;
+			break;
+		}
+	}
+	// 途中で失敗してもストリームは閉じる
+	SD::Result endResult = EndStream();
+
+	return (result != SD::Result::Ok) ? result : endResult;
+}
+
+SD::Result SdDriver::StartStreamBlock()
+{
+	SD::Result result = WaitDataStartToken();
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+	m_IsStreamLatencyLong = (m_TokenWaitCount >= SD::SECTOR_SIZE);
+
+	BeginReceiveData(&m_pStreamBuffer[m_StreamFill * SD::SECTOR_SIZE], SD::SECTOR_SIZE);
+	m_IsStreamReceiving = true;
+	m_StreamRemain--;
+
+	return SD::Result::Ok;
+}
+
+void SdDriver::HuntStreamBlock()
+{
+	// カードの準備ができるまでは 0xFF が返るので、トークンがどこから始まってもよい
+	m_pTransport->BeginReceive(&m_pStreamBuffer[m_StreamFill * SD::SECTOR_SIZE], SD::SECTOR_SIZE);
+	m_IsStreamReceiving = true;
+	m_IsStreamHunting = true;
+	m_StreamRemain--;
+}
+
+SD::Result SdDriver::EndHuntStreamBlock(uint8_t *pBuffer)
+{
+	m_pTransport->EndReceive();
+	SD::Result result = CheckTransport();
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	uint32_t offset = 0;
+	while ((offset < SD::SECTOR_SIZE) && (pBuffer[offset] != SD::DATA_START_TOKEN_EXCEPT_CMD25)) {
+		result = CheckDataErrorToken(pBuffer[offset]);
+		if (result != SD::Result::Ok) {
+			return result;
+		}
+		offset++;
+	}
+	if (offset == SD::SECTOR_SIZE) {
+		// 1 セクタ分の転送時間が過ぎてもカードの準備ができていなかった
+		return ReceiveDataPacket(pBuffer, SD::SECTOR_SIZE);
+	}
+
+	// 準備が短くなったので、次のブロックからはトークンを待って受信する (詰め直しのコピーを避ける)
+	m_IsStreamLatencyLong = false;
+
+	// トークンの後ろに受信できている分を先頭に詰め、残りと CRC を受信する
+	uint32_t receivedSize = SD::SECTOR_SIZE - offset - 1;
+	memmove(pBuffer, &pBuffer[offset + 1], receivedSize);
+	m_pTransport->BeginReceive(&pBuffer[receivedSize], SD::SECTOR_SIZE - receivedSize);
+	return EndReceiveData(pBuffer, SD::SECTOR_SIZE);
+}
+
+SD::Result SdDriver::WriteSingleBlock(const uint8_t *pBuffer, uint32_t sectorIndex)
+{
+	SD::Result result = CheckR1(IssueCommandWriteSingleBlock(sectorIndex));
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	m_pTransport->Select();
+
+	uint8_t response = TransmitDataPacket(SD::DATA_START_TOKEN_EXCEPT_CMD25, pBuffer);
+	SD_LOG_DEBUG("[SD] Data Response: 0x%02X\n", response);
+	SD_TRACE(DataResponse, 0, response);
+	// 送信に失敗していればデータレスポンスも当てにならない
+	SD::Result transportResult = CheckTransport();
+	if (transportResult != SD::Result::Ok) {
+		PadDataPacket();
+	}
+
+	// Busy 中に CS を Hi にしてもカードは書き込みを続ける (Deferred なら次のコマンドの前に待つ)
+	if (m_WriteBusyMode == WriteBusyMode::Immediate) {
+		result = WaitWhileBusy(m_WriteTimeoutMs);
+	}
+
+	m_pTransport->Deselect();
+
+	if (transportResult != SD::Result::Ok) {
+		return transportResult;
+	}
+	// 拒否された場合はそちらを優先して返す
+	SD::Result responseResult = ToResult(response);
+	return (responseResult != SD::Result::Ok) ? responseResult : result;
+}
+
+SD::Result SdDriver::WriteMultipleBlock(const uint8_t *pBuffer, const uint8_t *const *ppBuffers, uint32_t sectorIndex, uint32_t count)
+{
+	SD::Result result = CheckR1(IssueCommandWriteMultipleBlock(sectorIndex));
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	m_pTransport->Select();
+
+	for (uint32_t i = 0; i < count; i++) {
+		const uint8_t *pBlock = (ppBuffers != nullptr) ? ppBuffers[i] : &pBuffer[i * SD::SECTOR_SIZE];
+		uint8_t response = TransmitDataPacket(SD::DATA_START_TOKEN_CMD25, pBlock);
+		SD::Result transportResult = CheckTransport();
+		if (transportResult != SD::Result::Ok) {
+			PadDataPacket();
+		}
+		// 次のブロックも Stop Tran トークンも Busy が解除されるまで送れない
+		result = WaitWhileBusy(m_WriteTimeoutMs);
+		if (transportResult != SD::Result::Ok) {
+			// 送信に失敗したブロックのデータレスポンスは当てにならないので、Stop Tran トークンで終了する
+			// (Busy がタイムアウトした場合は下でもう一度待つ)
+			if (result != SD::Result::Timeout) {
+				result = transportResult;
+			}
+			break;
+		}
+		SD::Result responseResult = ToResult(response);
+		if (responseResult != SD::Result::Ok) {
+			// 拒否された以降のブロックは送らずに Stop Tran トークンで終了する
+			SD_LOG_ERROR("[SD] Error: Data Response 0x%02X (Block %lu/%lu).\n", response, i, count);
+			SD_TRACE(DataResponse, 0, response);
+			result = responseResult;
+			break;
+		}
+		if (result != SD::Result::Ok) {
 			break;
 		}
 	}
 
+	// Busy の間は Stop Tran トークンを受け付けないので、タイムアウトした場合はもう一度だけ待つ
+	if (result == SD::Result::Timeout) {
+		WaitWhileBusy(m_WriteTimeoutMs);
+	}
+
+	// Stop Tran トークンの後は 1 バイト空けてから Busy になる
+	uint8_t txData[2] = { SD::DATA_STOP_TOKEN, 0xFF };
+	m_pTransport->Send(txData, sizeof(txData));
+	SD::Result stopResult = CheckTransport();
+	if ((stopResult == SD::Result::Ok) && (m_WriteBusyMode == WriteBusyMode::Immediate)) {
+		stopResult = WaitWhileBusy(m_WriteTimeoutMs);
+	}
+
+	m_pTransport->Deselect();
+
+	return (result != SD::Result::Ok) ? result : stopResult;
+}
+
+SD::Result SdDriver::EraseBlock(uint32_t sectorIndex)
+{
+	// CMD32/CMD33 で消去範囲の先頭/末尾を指定して CMD38 で消去する
+	SD::Result result = CheckR1(IssueCommandEraseWrBlkStart(sectorIndex));
+	if (result == SD::Result::Ok) {
+		result = CheckR1(IssueCommandEraseWrBlkEnd(sectorIndex));
+	}
+	if (result == SD::Result::Ok) {
+		result = CheckR1(IssueCommandErase());
+	}
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	// 消去が終わるまで Busy になる
+	return WaitReady(m_EraseTimeoutMs);
+}
+
+SD::Result SdDriver::ReadRegister(SD::CID *pOutRegister)
+{
+	SD::Result result = CheckR1(IssueCommandSendCid());
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	// データパケット読み込み
 	uint8_t rxData[SD::CID_SIZE];
-	HAL_SPI_TransmitReceive(m_Spi, m_Dummy, rxData, sizeof(rxData), 0xFFFF);
-	CsDisable();
+	m_pTransport->Select();
+	result = ReceiveDataPacket(rxData, sizeof(rxData));
+	m_pTransport->Deselect();
+	if (result != SD::Result::Ok) {
+		return result;
+	}
 
 	pOutRegister->MID    = rxData[0];
 	pOutRegister->OID    = (static_cast<uint16_t>(rxData[1]) << 8) | rxData[2];
@@ -795,12 +2077,17 @@ void SdDriver::ReadRegister(SD::CID *pOutRegister)
 							(static_cast<uint32_t>(rxData[12]) <<  0));
 	pOutRegister->MDT    = static_cast<uint16_t>(rxData[13] << 8) | rxData[14];
 	pOutRegister->CRC7   = rxData[15];
+
+	return SD::Result::Ok;
 }
 
-void SdDriver::ReadRegister(SD::OCR *pOutRegister)
+SD::Result SdDriver::ReadRegister(SD::OCR *pOutRegister)
 {
 	uint32_t ocr = 0;
-	IssueCommandReadOcr(&ocr);
+	SD::Result result = CheckR1(IssueCommandReadOcr(&ocr));
+	if (result != SD::Result::Ok) {
+		return result;
+	}
 
 	pOutRegister->CARD_POWER_UP_STATUS_BIT = (uint8_t)((ocr & 0x80000000) >> 31);
 	pOutRegister->CARD_CAPACITY_STATUS     = (uint8_t)((ocr & 0x40000000) >> 30);
@@ -824,28 +2111,25 @@ void SdDriver::ReadRegister(SD::OCR *pOutRegister)
 	pOutRegister->VDD_VOLTAGE_WINDOW_19_18 = (uint8_t)((ocr & 0x00000040) >>  6);
 	pOutRegister->VDD_VOLTAGE_WINDOW_18_17 = (uint8_t)((ocr & 0x00000020) >>  5);
 	pOutRegister->VDD_VOLTAGE_WINDOW_17_16 = (uint8_t)((ocr & 0x00000010) >>  4);
+
+	return SD::Result::Ok;
 }
 
-void SdDriver::ReadRegister(SD::CSD *pOutRegister)
+SD::Result SdDriver::ReadRegister(SD::CSD *pOutRegister)
 {
-	IssueCommandSendCsd();
-
-	// MEMO: セクタ読み込みと同じ方式
-	// TODO: データパケット読み込みの共通化
-	// データパケット読み込み
-	CsEnable();
-	while (1) {
-		uint8_t txData[1] = { 0xFF };
-		uint8_t rxData[1];
-		HAL_SPI_TransmitReceive(m_Spi, txData, rxData, 1, 0xFFFF);
-		if (rxData[0] == SD::DATA_START_TOKEN_EXCEPT_CMD25) {
-			break;
-		}
+	SD::Result result = CheckR1(IssueCommandSendCsd());
+	if (result != SD::Result::Ok) {
+		return result;
 	}
 
+	// データパケット読み込み
 	uint8_t rxData[SD::CSD_SIZE];
-	HAL_SPI_TransmitReceive(m_Spi, m_Dummy, rxData, sizeof(rxData), 0xFFFF);
-	CsDisable();
+	m_pTransport->Select();
+	result = ReceiveDataPacket(rxData, sizeof(rxData));
+	m_pTransport->Deselect();
+	if (result != SD::Result::Ok) {
+		return result;
+	}
 
     pOutRegister->CSD_STRUCTURE       = (rxData[0] & 0xC0) >> 6;
     pOutRegister->TAAC                = rxData[1];
@@ -877,28 +2161,25 @@ void SdDriver::ReadRegister(SD::CSD *pOutRegister)
     pOutRegister->TMP_WRITE_PROTECT   = (rxData[14] & 0x10) >> 1;
     pOutRegister->FILE_FORMAT         = (rxData[14] & 0x0C) >> 2;
     pOutRegister->CRC7                = (rxData[15] & 0xFE) >> 1;
+
+	return SD::Result::Ok;
 }
 
-void SdDriver::ReadRegister(SD::SCR *pOutRegister)
+SD::Result SdDriver::ReadRegister(SD::SCR *pOutRegister)
 {
-	IssueCommandSendScr();
-
-	// MEMO: セクタ読み込みと同じ方式
-	// TODO: データパケット読み込みの共通化
-	// データパケット読み込み
-	CsEnable();
-	while (1) {
-		uint8_t txData[1] = { 0xFF };
-		uint8_t rxData[1];
-		HAL_SPI_TransmitReceive(m_Spi, txData, rxData, 1, 0xFFFF);
-		if (rxData[0] == SD::DATA_START_TOKEN_EXCEPT_CMD25) {
-			break;
-		}
+	SD::Result result = CheckR1(IssueCommandSendScr());
+	if (result != SD::Result::Ok) {
+		return result;
 	}
 
+	// データパケット読み込み
 	uint8_t rxData[SD::SCR_SIZE];
-	HAL_SPI_TransmitReceive(m_Spi, m_Dummy, rxData, sizeof(rxData), 0xFFFF);
-	CsDisable();
+	m_pTransport->Select();
+	result = ReceiveDataPacket(rxData, sizeof(rxData));
+	m_pTransport->Deselect();
+	if (result != SD::Result::Ok) {
+		return result;
+	}
 
 	pOutRegister->SCR_STRUCTURE         = (rxData[0] & 0xF0) >> 4;
 	pOutRegister->SD_SPEC               = (rxData[0] & 0x0F);
@@ -909,28 +2190,25 @@ void SdDriver::ReadRegister(SD::SCR *pOutRegister)
 	pOutRegister->EX_SECURITY           = (rxData[2] & 0x78) >> 3;
 	pOutRegister->SD_SPEC4              = (rxData[2] & 0x04) >> 2;
 	pOutRegister->CMD_SUPPORT           = (rxData[3] & 0x0F);
+
+	return SD::Result::Ok;
 }
 
-void SdDriver::ReadRegister(SD::SSR *pOutRegister)
+SD::Result SdDriver::ReadRegister(SD::SSR *pOutRegister)
 {
-	IssueCommandSdStatus();
-
-	// MEMO: セクタ読み込みと同じ方式
-	// TODO: データパケット読み込みの共通化
-	// データパケット読み込み
-	CsEnable();
-	while (1) {
-		uint8_t txData[1] = { 0xFF };
-		uint8_t rxData[1];
-		HAL_SPI_TransmitReceive(m_Spi, txData, rxData, 1, 0xFFFF);
-		if (rxData[0] == SD::DATA_START_TOKEN_EXCEPT_CMD25) {
-			break;
-		}
+	SD::Result result = CheckR1(IssueCommandSdStatus());
+	if (result != SD::Result::Ok) {
+		return result;
 	}
 
+	// データパケット読み込み
 	uint8_t rxData[SD::SSR_SIZE];
-	HAL_SPI_TransmitReceive(m_Spi, m_Dummy, rxData, sizeof(rxData), 0xFFFF);
-	CsDisable();
+	m_pTransport->Select();
+	result = ReceiveDataPacket(rxData, sizeof(rxData));
+	m_pTransport->Deselect();
+	if (result != SD::Result::Ok) {
+		return result;
+	}
 
 	pOutRegister->DAT_BUS_WIDTH			 = (rxData[0] & 0xC0) >> 6;
 	pOutRegister->SECURED_MODE			 = (rxData[0] & 0x20) >> 5;
@@ -945,4 +2223,6 @@ void SdDriver::ReadRegister(SD::SSR *pOutRegister)
 	pOutRegister->ERASE_SIZE			 = (((uint16_t)rxData[11] << 8) | rxData[12]);
 	pOutRegister->ERASE_TIMEOUT			 = (rxData[13] & 0xFC) >> 2;
 	pOutRegister->ERASE_OFFSET			 = (rxData[13] & 0x03);
+
+	return SD::Result::Ok;
 }
@@ -5,18 +5,30 @@
 #include <stdio.h>
 #include <cstdint>
 
-#include "stm32f3xx_hal_spi.h"
-
 #include "Sd.hpp"
+#include "SdLog.hpp"
+#include "SdProfile.hpp"
+#include "SdTransport.hpp"
 
-#define DEBUG_LOG(...)  printf(__VA_ARGS__)
+class SdWriteCache;
+class SdReadAhead;
+class SdSectorCache;
 
-extern "C" int ConsoleReadLine(uint8_t *pOutBuffer);
+extern "C" bool ConsoleIsLineAvailable(void);
+extern "C" int ConsoleReadLine(uint8_t *pOutBuffer, int bufferSize);
+extern "C" void ConsoleFlush(void);
+extern "C" uint32_t ConsoleGetDropCount(void);
 
+#ifdef SD_HOST_SIMULATOR
+// ホストのシミュレータでは止まらずに異常終了する
+#include <cstdlib>
+static inline void ABORT() { exit(EXIT_FAILURE); }
+#else
 static inline void ABORT() { while (1); }
+#endif
 
 #define __ASSERT(expr, file, line)                         \
-	DEBUG_LOG("Assertion failed: %s, file %s, line %d\n",  \
+	SD_LOG_ERROR("Assertion failed: %s, file %s, line %d\n",  \
 		expr, file, line),                                 \
 	ABORT()
 
@@ -26,8 +38,50 @@ static inline void ABORT() { while (1); }
 
 class SdDriver
 {
+public:
+	// REPL で切り替えられる通信路の最大数
+	static constexpr uint32_t TRANSPORT_COUNT_MAX = 4;
+
+	// データパケットの CRC 確認方式
+	enum class CrcMode {
+		Disabled,	// CRC を確認しない (SPI モードのデフォルト)
+		Software,	// CMD59 で CRC を有効にし、データパケットの CRC16 をソフトウェアで計算する
+		Hardware,	// CMD59 で CRC を有効にし、データパケットの CRC16 を SPI の CRC 計算ユニットで計算する
+	};
+
+	// 書き込み後の Busy (カード内部の書き込み) を待つタイミング
+	enum class WriteBusyMode {
+		Immediate,	// データレスポンス (CMD25 は Stop Tran トークン) の後、Busy が解除されるまで待ってから戻る
+		Deferred,	// データレスポンスを受けたらすぐ戻り、次のコマンドを発行する前に待つ
+	};
+
+	// カードの Busy (書き込み、消去、CMD12 など) が解除されるのを待つ方法
+	enum class BusyWaitMode {
+		Polling,	// 0xFF を送り続け、0xFF が返ってくるまで待つ
+		Interrupt,	// SPI のクロックを止め、MISO の立ち上がりを EXTI 割り込みで待つ (待つ間 CPU は眠る)
+	};
+
+	// 失敗時の再試行方針
+	// タイムアウトや CRC エラーなど、カードの一時的な不調で起こりうる失敗のみ再試行する。
+	struct RetryPolicy {
+		uint32_t maxRetryCount;		// 再試行回数 (0 なら再試行しない)
+		uint32_t retryDelayMs;		// 再試行前の待ち時間 [ms]
+	};
+
+	static const RetryPolicy DefaultRetryPolicy;
+
+	// ReadSectors() で読み出したセクタを 1 つずつ受け取るコールバック
+	// pSector は転送バッファそのもので、コールバックから戻るまでの間だけ有効。
+	// false を返すと残りを読まずに終える。読み出し中なのでドライバの他の API は呼べない。
+	typedef bool (*SectorCallback)(void *pContext, uint32_t sectorIndex, const uint8_t *pSector);
+
 private:
-	SPI_HandleTypeDef *m_Spi;
+	// カードとの通信路
+	SdTransport *m_pTransport;
+
+	// REPL で切り替えられる通信路 (AddTransport() で登録)
+	SdTransport *m_pTransports[TRANSPORT_COUNT_MAX];
+	uint32_t m_TransportCount;
 
 	// 初期化済みフラグ
 	bool m_IsInitialized;
@@ -35,70 +89,239 @@ private:
 	// セクタ総数
 	uint32_t m_SectorCount;
 
-	// SPI 送信用のダミーデータ
-	// 全て 0xFF で埋めて使用すること。
-	uint8_t m_Dummy[SD::SECTOR_SIZE];
+	// 現在の SPI クロック [Hz]
+	uint32_t m_SpiClock;
+
+	// タイムアウト [ms] (Initialize() で CSD/SSR から求める)
+	uint32_t m_ReadTimeoutMs;
+	uint32_t m_WriteTimeoutMs;
+	uint32_t m_EraseTimeoutMs;
+
+	// データパケットの CRC 確認方式
+	CrcMode m_CrcMode;
+
+	// 書き込み後の Busy 待ちのタイミング
+	WriteBusyMode m_WriteBusyMode;
+
+	// Busy 解除の待ち方
+	BusyWaitMode m_BusyWaitMode;
+
+	// 受信データパケットの CRC 不一致回数
+	uint32_t m_CrcErrorCount;
+
+	// 再試行方針と累計の再試行回数
+	RetryPolicy m_RetryPolicy;
+	uint32_t m_RetryCount;
+
+	// 最後に確認した R1 (SD::Result::R1Error の詳細)
+	uint8_t m_LastR1;
+
+	// 最後の WaitDataStartToken() で開始トークンの前に読み捨てたバイト数
+	uint32_t m_TokenWaitCount;
+
+	// CMD18 によるマルチブロック読み出しストリームを開いている
+	bool m_IsReading;
+
+	// ダブルバッファ逐次読み出しの状態 (BeginStream() から EndStream() まで)
+	uint8_t *m_pStreamBuffer;		// 2 セクタ分 (nullptr ならストリームなし)
+	uint32_t m_StreamRemain;		// まだ受信を始めていないセクタ数
+	uint32_t m_StreamFill;			// 受信先のバッファ (0/1)
+	bool m_IsStreamReceiving;		// m_StreamFill 側に受信中
+	bool m_IsStreamHunting;			// 受信中の 1 セクタ分は開始トークンを待たずに始めたもの
+	bool m_IsStreamLatencyLong;		// 開始トークンまでが 1 セクタの転送時間より長かった
+	SD::Result m_StreamResult;		// 受信を始められなかった原因
+
+	// アイドル時に書き出すライトバックキャッシュ (SetWriteCache() で登録)
+	SdWriteCache *m_pWriteCache;
+
+	// 書き込み/消去で破棄させる先読みバッファとセクタキャッシュ
+	SdReadAhead *m_pReadAhead;
+	SdSectorCache *m_pSectorCache;
 
 public:
-	SdDriver(SPI_HandleTypeDef *spi);
+	SdDriver(SdTransport *pTransport);
 	~SdDriver();
 
-	void Initialize();
+	SD::Result Initialize();
 	void MainLoop();
+	// コンソール入力待ちなど、手が空いている間に繰り返し呼ぶ
+	void OnIdle();
+
+	// 通信路の切り替え (コマンドの合間に呼ぶこと)
+	void SetTransport(SdTransport *pTransport);
+	// REPL の "transport" コマンドで切り替えられるようにする
+	void AddTransport(SdTransport *pTransport);
+	SD::Result SetCrcMode(CrcMode mode);
+	void SetRetryPolicy(const RetryPolicy &policy);
+	void SetWriteBusyMode(WriteBusyMode mode);
+	// 通信路が対応していなければ (SdTransport::IsBusyInterruptSupported()) Polling になる
+	void SetBusyWaitMode(BusyWaitMode mode);
+	// OnIdle() で書き出させる (REPL の "sync", "bench logw" でも使う)
+	void SetWriteCache(SdWriteCache *pWriteCache);
+	// WriteSector()/EraseSector() で先読みしたデータを破棄させる
+	void SetReadAhead(SdReadAhead *pReadAhead);
+	void SetSectorCache(SdSectorCache *pSectorCache);
+
+	uint32_t GetSectorCount() const;
+	uint32_t GetSpiClock() const;
+	SdTransport *GetTransport() const;
+	uint32_t GetRetryCount() const;
+	uint8_t GetLastR1() const;
+	SdWriteCache *GetWriteCache() const;
+	SdReadAhead *GetReadAhead() const;
+	SdSectorCache *GetSectorCache() const;
+
+	// 失敗した場合は RetryPolicy に従って再試行し、それでも失敗すれば原因を返す
+	SD::Result ReadSector(uint8_t *pOutBuffer, uint32_t sectorIndex);
+	SD::Result ReadSector(uint8_t *pOutBuffer, uint32_t sectorIndex, uint32_t blockNum);
+	SD::Result WriteSector(const uint8_t *pBuffer, uint32_t sectorIndex);
+	SD::Result WriteSector(const uint8_t *pBuffer, uint32_t sectorIndex, uint32_t count);
+	SD::Result EraseSector(uint32_t sectorIndex);
+
+	// 書き込みの完了 (Busy 解除) を待つ
+	// WriteBusyMode::Deferred では WriteSector() などが戻った時点ではまだカードが書き込み中なので、
+	// 電源断やカードの抜き取りの前に呼ぶこと。
+	SD::Result WaitWriteComplete();
+
+	// 連続したセクタを 1 回の CMD18/CMD25 でセクタ毎の別々のバッファに読み書きする
+	// ppBuffers[i] がセクタ sectorIndex + i の 512 バイトのバッファ。
+	SD::Result ReadSectorsV(uint8_t *const *ppOutBuffers, uint32_t sectorIndex, uint32_t count);
+	SD::Result WriteSectorsV(const uint8_t *const *ppBuffers, uint32_t sectorIndex, uint32_t count);
+
+	// 任意のセクタ数を一定のメモリで読み出す (CMD18)
+	// pDoubleBuffer の 2 セクタ (1024 バイト) を BeginStream() と同じく交互に使い、
+	// 受信したセクタをコピーせずにそのまま pCallback に渡す。
+	// DMA の通信路では、コールバックの処理中に次のセクタを受信する。
+	// 途中で失敗した場合は、渡し終えたセクタの次から読み直す (同じセクタを 2 度渡すことはない)。
+	SD::Result ReadSectors(uint32_t sectorIndex, uint32_t count, uint8_t *pDoubleBuffer, SectorCallback pCallback, void *pContext);
+
+	// 逐次読み出し (CMD18 を EndRead() まで開いたままにする)
+	// ストリームを開いている間は他のコマンドを発行できない。
+	// NextSector() がタイムアウトした場合も EndRead() で閉じること。
+	SD::Result BeginRead(uint32_t sectorIndex);
+	SD::Result NextSector(uint8_t *pOutBuffer);
+	SD::Result EndRead();
+
+	// ダブルバッファによる逐次読み出し (CMD18)
+	// pDoubleBuffer の 2 セクタ (1024 バイト) を交互に使い、NextStreamSector() で渡した
+	// セクタを呼び出し側が処理している間に、もう一方へ次のブロックを受信しておく
+	// (裏で受信が進むのは DMA の通信路のみ。他の通信路では次の呼び出しまで受信を始めない)。
+	// DMA の通信路でも次のブロックの開始トークンは返す前に待つので、カードの準備時間は処理と重ならない。
+	// ただし準備に 1 セクタの転送時間以上かかるカードでは、トークンを待たずに 1 セクタ分の受信を
+	// 始めておき (0xFF の間に準備が進む)、次の呼び出しでトークンを待って受信する。
+	// ハードウェア CRC ではトークンの前の 0xFF も計算に含まれてしまうため、常にトークンを待つ。
+	// 渡したセクタは次の NextStreamSector()/EndStream() まで有効。
+	// 失敗した場合は BeginRead() と同じく再試行せず、EndStream() で閉じて読み直すこと。
+	SD::Result BeginStream(uint32_t sectorIndex, uint32_t count, uint8_t *pDoubleBuffer);
+	SD::Result NextStreamSector(const uint8_t **ppOutSector);
+	SD::Result EndStream();
+
+	// 書き込み/消去する範囲のデータを持つ読み出しキャッシュを破棄する
+	// WriteSector()/EraseSector() は自動で呼ぶ。ドライバを通さずに内容を変える場合
+	// (SdWriteCache に溜めた場合など) は呼び出し側で呼ぶこと。
+	void InvalidateCaches(uint32_t sectorIndex, uint32_t count);
+
+	static const char *GetResultName(SD::Result result);
 
 private:
+	uint32_t SetSpiClock(uint32_t maxClock);
+	void UpdateTimeouts(const SD::CSD &csd, const SD::SSR &ssr);
+
+	SD::Result CheckRange(uint32_t sectorIndex, uint32_t count) const;
+	SD::Result CheckR1(uint8_t r1Response);
+	SD::Result CheckR1(uint8_t r1Response, bool isIdleAllowed);
+	SD::Result CheckTransport();
+	bool ShouldRetry(SD::Result result, uint32_t *pRetryCount);
+
+	// 再試行なしの 1 回分の処理
+	// マルチブロックはバッファの一覧 (pp...) が nullptr なら連続したバッファを使う。
+	SD::Result ReadSingleBlock(uint8_t *pOutBuffer, uint32_t sectorIndex);
+	SD::Result ReadMultipleBlock(uint8_t *pOutBuffer, uint8_t *const *ppOutBuffers, uint32_t sectorIndex, uint32_t blockNum);
+	SD::Result ReadMultipleBlock(uint32_t sectorIndex, uint32_t count, uint8_t *pDoubleBuffer, SectorCallback pCallback, void *pContext, uint32_t *pOutDoneCount, bool *pOutIsStopped);
+	SD::Result WriteSingleBlock(const uint8_t *pBuffer, uint32_t sectorIndex);
+	SD::Result WriteMultipleBlock(const uint8_t *pBuffer, const uint8_t *const *ppBuffers, uint32_t sectorIndex, uint32_t count);
+	SD::Result EraseBlock(uint32_t sectorIndex);
+
 	uint8_t IssueCommand(uint8_t command, uint32_t argument, SD::ResponseType responseType, void *pAdditionalResponse);
 	uint8_t IssueCommand(uint8_t command, uint32_t argument, SD::ResponseType responseType);
 
 	// CMD0
-	void IssueCommandGoIdleState();
+	SD::Result IssueCommandGoIdleState();
 	// CMD8
-	void IssueCommandSendIfCond();
+	SD::Result IssueCommandSendIfCond();
 	// CMD9
-	void IssueCommandSendCsd();
+	uint8_t IssueCommandSendCsd();
 	// CMD10
-	void IssueCommandSendCid();
+	uint8_t IssueCommandSendCid();
 	// CMD12
-	void IssueCommandStopTransmission();
+	uint8_t IssueCommandStopTransmission();
 	// CMD13
 	void IssueCommandGetStatus();
 	// CMD16
-	void IssueCommandSetBlocklen();
+	uint8_t IssueCommandSetBlocklen();
 	// CMD17
-	void IssueCommandReadSingleBlock(uint32_t sectorIndex);
+	uint8_t IssueCommandReadSingleBlock(uint32_t sectorIndex);
 	// CMD18
-	void IssueCommandReadMultipleBlock(uint32_t sectorIndex);
+	uint8_t IssueCommandReadMultipleBlock(uint32_t sectorIndex);
 	// CMD24
-	void IssueCommandWriteSingleBlock(uint32_t sectorIndex);
+	uint8_t IssueCommandWriteSingleBlock(uint32_t sectorIndex);
 	// CMD25
-	void IssueCommandWriteMultipleBlock(uint32_t sectorIndex);
+	uint8_t IssueCommandWriteMultipleBlock(uint32_t sectorIndex);
+	// CMD32
+	uint8_t IssueCommandEraseWrBlkStart(uint32_t sectorIndex);
+	// CMD33
+	uint8_t IssueCommandEraseWrBlkEnd(uint32_t sectorIndex);
+	// CMD38
+	uint8_t IssueCommandErase();
 	// CMD55
-	void IssueCommandAppCmd();
+	uint8_t IssueCommandAppCmd();
+	// CMD55 + ACMDn (R1)
+	uint8_t IssueAppCommand(uint8_t command, uint32_t argument);
+	// CMD59
+	uint8_t IssueCommandCrcOnOff(bool isEnabled);
 	// CMD58
-	void IssueCommandReadOcr(uint32_t *pOutOcr);
+	uint8_t IssueCommandReadOcr(uint32_t *pOutOcr);
 	// ACMD13
-	void IssueCommandSdStatus();
+	uint8_t IssueCommandSdStatus();
 	// ACMD41
-	void IssueCommandAppSendOpCond();
+	SD::Result IssueCommandAppSendOpCond();
 	// ACMD51
-	void IssueCommandSendScr();
+	uint8_t IssueCommandSendScr();
 
 	uint8_t GetResponseR1();
 	uint8_t GetResponseR1b();
 	uint8_t GetResponseR2(uint8_t *pOutErrorStatus);
 	uint8_t GetResponseR3R7(uint32_t *pOutReturnValue);
 	uint8_t GetDataResponse();
-	
-	void ReadSector(uint8_t *pOutBuffer, uint32_t sectorIndex);
-	void ReadSector(uint8_t *pOutBuffer, uint32_t sectorIndex, uint32_t blockNum);
-	void WriteSector(const uint8_t *pBuffer, uint32_t sectorIndex);
-	void EraseSector(uint32_t sectorIndex);
-
-	void ReadRegister(SD::CID *pOutRegister);
-	void ReadRegister(SD::CSD *pOutRegister);
-	void ReadRegister(SD::OCR *pOutRegister);
-	void ReadRegister(SD::SCR *pOutRegister);
-	void ReadRegister(SD::SSR *pOutRegister);
+	SD::Result WaitWhileBusy(uint32_t timeoutMs);
+	// CS を Lo にして Busy 解除を待つ (R1b コマンドの後に呼ぶ)
+	SD::Result WaitReady(uint32_t timeoutMs);
+
+	// データパケット (開始トークン + データ + CRC) の受信
+	SD::Result ReceiveDataPacket(uint8_t *pOutBuffer, uint32_t size);
+	// ReceiveDataPacket() の各段階 (データの受信中に他の処理を挟めるように分けたもの)
+	SD::Result WaitDataStartToken();
+	void BeginReceiveData(uint8_t *pOutBuffer, uint32_t size);
+	SD::Result EndReceiveData(const uint8_t *pBuffer, uint32_t size);
+	// データエラートークンなら原因を返す (それ以外のバイトは Ok)
+	SD::Result CheckDataErrorToken(uint8_t token);
+	// 次のブロックの開始トークンを待って m_StreamFill 側への受信を始める
+	SD::Result StartStreamBlock();
+	// 開始トークンを待たずに m_StreamFill 側へ 1 セクタ分の受信を始める
+	void HuntStreamBlock();
+	// HuntStreamBlock() で受信した分からトークンを探し、データを先頭に詰めて残りを受信する
+	// (トークンが来ていなければここで待ってから受信する)
+	SD::Result EndHuntStreamBlock(uint8_t *pBuffer);
+
+	// データパケット (開始トークン + データ + CRC) の送信
+	uint8_t TransmitDataPacket(uint8_t token, const uint8_t *pBuffer);
+	void PadDataPacket();
+
+	SD::Result ReadRegister(SD::CID *pOutRegister);
+	SD::Result ReadRegister(SD::CSD *pOutRegister);
+	SD::Result ReadRegister(SD::OCR *pOutRegister);
+	SD::Result ReadRegister(SD::SCR *pOutRegister);
+	SD::Result ReadRegister(SD::SSR *pOutRegister);
 };
 
 #endif /* SD_SAMPLE_HPP */
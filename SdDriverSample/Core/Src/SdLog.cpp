@@ -0,0 +1,66 @@
+#include "SdLog.hpp"
+
+#ifdef SD_TRACE_ENABLE
+
+#include "SdTimer.hpp"
+
+namespace {
+
+struct TraceEntry {
+	uint32_t timestamp;	// DWT サイクルカウンタ
+	uint32_t value;
+	uint8_t  event;
+	uint8_t  arg;
+};
+
+TraceEntry g_TraceBuffer[SD_TRACE_DEPTH];
+uint32_t g_TraceCount = 0;	// 記録した総イベント数 (上書き分を含む)
+
+const char *GetEventName(uint8_t event)
+{
+	switch (static_cast<SdTrace::Event>(event)) {
+	case SdTrace::Event::Command:      return "CMD";
+	case SdTrace::Event::Response:     return "RESP";
+	case SdTrace::Event::BusyCount:    return "BUSY";
+	case SdTrace::Event::DataResponse: return "DRESP";
+	case SdTrace::Event::CrcError:     return "CRCERR";
+	default:                           return "?";
+	}
+}
+
+} // namespace
+
+namespace SdTrace {
+
+void Record(Event event, uint8_t arg, uint32_t value)
+{
+	// 初回記録時にサイクルカウンタを有効にする
+	SdTimer::EnableCycleCounter();
+
+	TraceEntry &entry = g_TraceBuffer[g_TraceCount % SD_TRACE_DEPTH];
+	entry.timestamp = SdTimer::GetCycles();
+	entry.value = value;
+	entry.event = static_cast<uint8_t>(event);
+	entry.arg = arg;
+	g_TraceCount++;
+}
+
+void Clear()
+{
+	g_TraceCount = 0;
+}
+
+void Dump()
+{
+	uint32_t first = (g_TraceCount > SD_TRACE_DEPTH) ? (g_TraceCount - SD_TRACE_DEPTH) : 0;
+
+	printf("[SD] Trace: %lu events (showing last %lu)\n", g_TraceCount, g_TraceCount - first);
+	for (uint32_t i = first; i < g_TraceCount; i++) {
+		const TraceEntry &entry = g_TraceBuffer[i % SD_TRACE_DEPTH];
+		printf("  %10lu %-6s %3u 0x%08lX\n", entry.timestamp, GetEventName(entry.event), entry.arg, entry.value);
+	}
+}
+
+}
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef SD_LOG_HPP
+#define SD_LOG_HPP
+
+#include <stdio.h>
+#include <cstdint>
+
+// ----------------------------------------------------------------------
+//  ログレベル
+// ----------------------------------------------------------------------
+// SD_LOG_LEVEL 以下のレベルのログのみ出力する。
+// それ以外はコンパイル時に消えるので引数の評価も行われない。
+// (書式のチェックと未使用変数の警告抑制のために評価されない式として残す)
+#define SD_LOG_LEVEL_NONE   0
+#define SD_LOG_LEVEL_ERROR  1
+#define SD_LOG_LEVEL_WARN   2
+#define SD_LOG_LEVEL_INFO   3
+#define SD_LOG_LEVEL_DEBUG  4	// コマンド毎のログ (1 コマンドあたり数 ms かかるので注意)
+
+// 未指定の場合は Debug ビルドは INFO、それ以外 (Release ビルド) は出力しない
+#ifndef SD_LOG_LEVEL
+#ifdef DEBUG
+#define SD_LOG_LEVEL SD_LOG_LEVEL_INFO
+#else
+#define SD_LOG_LEVEL SD_LOG_LEVEL_NONE
+#endif
+#endif
+
+#define SD_LOG_NOTHING(...) (0 ? (void)printf(__VA_ARGS__) : (void)0)
+
+#if SD_LOG_LEVEL >= SD_LOG_LEVEL_ERROR
+#define SD_LOG_ERROR(...)   printf(__VA_ARGS__)
+#else
+#define SD_LOG_ERROR(...)   SD_LOG_NOTHING(__VA_ARGS__)
+#endif
+
+#if SD_LOG_LEVEL >= SD_LOG_LEVEL_WARN
+#define SD_LOG_WARN(...)    printf(__VA_ARGS__)
+#else
+#define SD_LOG_WARN(...)    SD_LOG_NOTHING(__VA_ARGS__)
+#endif
+
+#if SD_LOG_LEVEL >= SD_LOG_LEVEL_INFO
+#define SD_LOG_INFO(...)    printf(__VA_ARGS__)
+#else
+#define SD_LOG_INFO(...)    SD_LOG_NOTHING(__VA_ARGS__)
+#endif
+
+#if SD_LOG_LEVEL >= SD_LOG_LEVEL_DEBUG
+#define SD_LOG_DEBUG(...)   printf(__VA_ARGS__)
+#else
+#define SD_LOG_DEBUG(...)   SD_LOG_NOTHING(__VA_ARGS__)
+#endif
+
+// ----------------------------------------------------------------------
+//  バイナリトレース
+// ----------------------------------------------------------------------
+// SD_TRACE_ENABLE を定義すると、イベントを RAM 上のリングバッファに
+// 固定長で記録する (printf と違い 1 イベント数十サイクルで済む)。
+// 内容は SdTrace::Dump() で後からまとめて出力する。
+#ifdef SD_TRACE_ENABLE
+
+#ifndef SD_TRACE_DEPTH
+#define SD_TRACE_DEPTH 64	// 記録するイベント数 (1 イベント 12 バイト)
+#endif
+
+namespace SdTrace {
+
+enum class Event : uint8_t {
+	Command,		// arg: コマンド番号, value: 引数
+	Response,		// arg: コマンド番号, value: R1 (R2/R3/R7 は追加の値を上位に詰める)
+	BusyCount,		// arg: -, value: Busy 待ちのバイト数
+	DataResponse,	// arg: -, value: データレスポンス
+	CrcError,		// arg: -, value: (受信 CRC << 16) | 計算 CRC
+};
+
+void Record(Event event, uint8_t arg, uint32_t value);
+void Clear();
+void Dump();
+
+}
+
+#define SD_TRACE(event, arg, value) SdTrace::Record(SdTrace::Event::event, (arg), (value))
+
+#else
+
+#define SD_TRACE(event, arg, value) ((void)0)
+
+#endif
+
+#endif /* SD_LOG_HPP */
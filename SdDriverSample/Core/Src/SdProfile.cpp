@@ -0,0 +1,145 @@
+#include "SdProfile.hpp"
+
+#ifdef SD_PROFILE_ENABLE
+
+#include <stdio.h>
+
+namespace {
+
+// バケット 0 の上限 (2^5 = 32 サイクル, SYSCLK 32MHz で 1us)
+constexpr uint32_t BucketShift = 5;
+
+// ACMD は CMD と番号が重なるので区別するためのフラグ
+constexpr uint8_t AppCommandFlag = 0x80;
+constexpr uint8_t InvalidKey = 0xFF;
+
+struct Histogram {
+	uint8_t  command;	// コマンド番号 (ACMD は AppCommandFlag 付き), 未使用は InvalidKey
+	uint8_t  phase;
+	uint16_t counts[SD_PROFILE_BUCKET_COUNT];	// 飽和カウンタ
+	uint64_t totalCycles;
+};
+
+Histogram g_Histograms[SD_PROFILE_HISTOGRAM_COUNT];
+uint32_t g_HistogramCount = 0;
+uint32_t g_DroppedCount = 0;	// 空きが無く記録できなかった回数
+
+uint8_t g_CurrentCommand = InvalidKey;
+uint8_t g_LastCommand = InvalidKey;
+
+const char *GetPhaseName(uint8_t phase)
+{
+	switch (static_cast<SdProfile::Phase>(phase)) {
+	case SdProfile::Phase::Command:  return "Total";
+	case SdProfile::Phase::Response: return "R1";
+	case SdProfile::Phase::Token:    return "Token";
+	case SdProfile::Phase::Data:     return "Data";
+	case SdProfile::Phase::Busy:     return "Busy";
+	default:                         return "?";
+	}
+}
+
+uint32_t GetBucketIndex(uint32_t cycles)
+{
+	// floor(log2(cycles)) - (BucketShift - 1) を 0 - (BUCKET_COUNT - 1) に丸める
+	uint32_t log2 = 31 - __CLZ(cycles | 1);
+	if (log2 < BucketShift) {
+		return 0;
+	}
+	uint32_t index = log2 - BucketShift + 1;
+	return (index < SD_PROFILE_BUCKET_COUNT) ? index : (SD_PROFILE_BUCKET_COUNT - 1);
+}
+
+Histogram *FindHistogram(uint8_t command, uint8_t phase)
+{
+	for (uint32_t i = 0; i < g_HistogramCount; i++) {
+		if ((g_Histograms[i].command == command) && (g_Histograms[i].phase == phase)) {
+			return &g_Histograms[i];
+		}
+	}
+	if (g_HistogramCount == SD_PROFILE_HISTOGRAM_COUNT) {
+		return nullptr;
+	}
+	Histogram *pHistogram = &g_Histograms[g_HistogramCount];
+	g_HistogramCount++;
+	pHistogram->command = command;
+	pHistogram->phase = phase;
+	for (uint32_t i = 0; i < SD_PROFILE_BUCKET_COUNT; i++) {
+		pHistogram->counts[i] = 0;
+	}
+	pHistogram->totalCycles = 0;
+	return pHistogram;
+}
+
+} // namespace
+
+namespace SdProfile {
+
+void SetCommand(uint8_t command)
+{
+	// 初回記録時にサイクルカウンタを有効にする
+	SdTimer::EnableCycleCounter();
+
+	// CMD55 の直後のコマンドは ACMD として扱う
+	g_CurrentCommand = (g_LastCommand == 55) ? (command | AppCommandFlag) : command;
+	g_LastCommand = command;
+}
+
+void Record(Phase phase, uint32_t cycles)
+{
+	Histogram *pHistogram = FindHistogram(g_CurrentCommand, static_cast<uint8_t>(phase));
+	if (pHistogram == nullptr) {
+		g_DroppedCount++;
+		return;
+	}
+	uint16_t &count = pHistogram->counts[GetBucketIndex(cycles)];
+	if (count != UINT16_MAX) {
+		count++;
+	}
+	pHistogram->totalCycles += cycles;
+}
+
+void Clear()
+{
+	g_HistogramCount = 0;
+	g_DroppedCount = 0;
+}
+
+void Dump()
+{
+	const uint32_t cyclesPerUs = SystemCoreClock / 1000000;
+
+	printf("[SD] Profile: %lu histograms, %lu dropped\n", g_HistogramCount, g_DroppedCount);
+	printf("  bucket n: < %lu us x 2^n (last bucket is open-ended)\n", (1UL << BucketShift) / cyclesPerUs);
+
+	for (uint32_t i = 0; i < g_HistogramCount; i++) {
+		const Histogram &histogram = g_Histograms[i];
+
+		uint32_t count = 0;
+		for (uint32_t j = 0; j < SD_PROFILE_BUCKET_COUNT; j++) {
+			count += histogram.counts[j];
+		}
+		uint32_t totalUs = SdTimer::CyclesToMicroseconds(histogram.totalCycles);
+
+		char name[8];
+		snprintf(name, sizeof(name), "%sCMD%u",
+			((histogram.command & AppCommandFlag) != 0) ? "A" : "",
+			histogram.command & ~AppCommandFlag);
+
+		printf("  %-6s %-5s n=%-6lu total %8lu us :",
+			name,
+			GetPhaseName(histogram.phase),
+			count,
+			totalUs);
+		for (uint32_t j = 0; j < SD_PROFILE_BUCKET_COUNT; j++) {
+			if (histogram.counts[j] != 0) {
+				printf(" [%lu]%u", j, histogram.counts[j]);
+			}
+		}
+		printf("\n");
+	}
+}
+
+}
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef SD_PROFILE_HPP
+#define SD_PROFILE_HPP
+
+#include <cstdint>
+
+// ----------------------------------------------------------------------
+//  コマンド/フェーズ毎のレイテンシ計測
+// ----------------------------------------------------------------------
+// SD_PROFILE_ENABLE を定義すると、DWT サイクルカウンタで各フェーズの
+// 所要時間を測り、(コマンド, フェーズ) 毎の log2 ヒストグラムに集計する。
+// 内容は SdProfile::Dump() でまとめて出力する。
+#ifdef SD_PROFILE_ENABLE
+
+#include "SdTimer.hpp"
+
+#ifndef SD_PROFILE_HISTOGRAM_COUNT
+#define SD_PROFILE_HISTOGRAM_COUNT 48	// (コマンド, フェーズ) の組の最大数 (1 組 56 バイト)
+#endif
+
+#ifndef SD_PROFILE_BUCKET_COUNT
+#define SD_PROFILE_BUCKET_COUNT 20		// バケット i は 2^(i+5) サイクル未満 (最後のバケットは上限なし)
+#endif
+
+namespace SdProfile {
+
+enum class Phase : uint8_t {
+	Command,		// コマンド全体 (CS Lo から CS Hi まで, 前のコマンドの Busy 待ちを含む)
+	Response,		// コマンド送信後の R1 待ち
+	Token,			// データ開始トークン待ち
+	Data,			// データブロックと CRC の転送
+	Busy,			// 書き込み/R1b の Busy 解除待ち
+};
+
+// 以降の記録を command に対するものとして扱う
+void SetCommand(uint8_t command);
+void Record(Phase phase, uint32_t cycles);
+void Clear();
+void Dump();
+
+}
+
+#define SD_PROFILE_COMMAND(command)     SdProfile::SetCommand(command)
+#define SD_PROFILE_START(name)          uint32_t name = SdTimer::GetCycles()
+#define SD_PROFILE_RECORD(phase, start) SdProfile::Record(SdProfile::Phase::phase, SdTimer::GetCycles() - (start))
+
+#else
+
+#define SD_PROFILE_COMMAND(command)     ((void)0)
+#define SD_PROFILE_START(name)          ((void)0)
+#define SD_PROFILE_RECORD(phase, start) ((void)0)
+
+#endif
+
+#endif /* SD_PROFILE_HPP */
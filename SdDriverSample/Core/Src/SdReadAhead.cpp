@@ -0,0 +1,128 @@
+#include "SdReadAhead.hpp"
+#include <cstring>
+
+static_assert(SD_READ_AHEAD_DEPTH_MIN >= 2, "Read-ahead depth must be at least 2 sectors.");
+static_assert(SD_READ_AHEAD_DEPTH_MIN <= SD_READ_AHEAD_SECTOR_COUNT, "SD_READ_AHEAD_DEPTH_MIN exceeds the buffer.");
+
+// ----------------------------------------------------------------------
+//  class public methods
+// ----------------------------------------------------------------------
+SdReadAhead::SdReadAhead(SdDriver *pDriver)
+	: m_pDriver(pDriver)
+	, m_Statistics()
+	, m_NextSector(0)
+	, m_SequentialCount(0)
+	, m_Depth(SD_READ_AHEAD_DEPTH_MIN)
+	, m_BufferStart(0)
+	, m_BufferCount(0)
+	, m_UsedCount(0)
+{
+	ASSERT(pDriver != nullptr);
+}
+
+const SdReadAhead::Statistics &SdReadAhead::GetStatistics() const
+{
+	return m_Statistics;
+}
+
+uint32_t SdReadAhead::GetDepth() const
+{
+	return m_Depth;
+}
+
+SD::Result SdReadAhead::Read(uint8_t *pOutBuffer, uint32_t sectorIndex)
+{
+	if (pOutBuffer == nullptr) {
+		return SD::Result::InvalidArgument;
+	}
+
+	// 連続読み出しの検出
+	if (sectorIndex == m_NextSector) {
+		m_SequentialCount++;
+	} else {
+		m_SequentialCount = 1;
+	}
+	m_NextSector = sectorIndex + 1;
+
+	if ((sectorIndex >= m_BufferStart) && (sectorIndex - m_BufferStart < m_BufferCount)) {
+		uint32_t index = sectorIndex - m_BufferStart;
+		memcpy(pOutBuffer, m_Buffer[index], SD::SECTOR_SIZE);
+		if (m_UsedCount < index + 1) {
+			m_UsedCount = index + 1;
+		}
+		m_Statistics.hitCount++;
+		return SD::Result::Ok;
+	}
+
+	m_Statistics.missCount++;
+	if (m_SequentialCount < SD_READ_AHEAD_TRIGGER) {
+		return m_pDriver->ReadSector(pOutBuffer, sectorIndex);
+	}
+
+	// 連続読み出し中なので、このセクタから m_Depth セクタをまとめて読む
+	Discard();
+	uint32_t count = m_Depth;
+	if (sectorIndex < m_pDriver->GetSectorCount()) {
+		uint32_t remain = m_pDriver->GetSectorCount() - sectorIndex;
+		if (count > remain) {
+			count = remain;
+		}
+	}
+	SD::Result result = (count == 1) ?
+		m_pDriver->ReadSector(m_Buffer[0], sectorIndex) :
+		m_pDriver->ReadSector(m_Buffer[0], sectorIndex, count);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+	m_Statistics.prefetchCount++;
+
+	m_BufferStart = sectorIndex;
+	m_BufferCount = count;
+	m_UsedCount = 1;
+	memcpy(pOutBuffer, m_Buffer[0], SD::SECTOR_SIZE);
+
+	return SD::Result::Ok;
+}
+
+void SdReadAhead::Invalidate(uint32_t sectorIndex, uint32_t count)
+{
+	if (m_BufferCount == 0) {
+		return;
+	}
+	// 重なっていなければ残す
+	if ((sectorIndex >= m_BufferStart + m_BufferCount) || (m_BufferStart >= sectorIndex + count)) {
+		return;
+	}
+	// 書き込みで捨てるのは先読みの失敗ではないので深さは変えない
+	m_BufferCount = 0;
+	m_UsedCount = 0;
+}
+
+// ----------------------------------------------------------------------
+//  class private methods
+// ----------------------------------------------------------------------
+void SdReadAhead::Discard()
+{
+	if (m_BufferCount == 0) {
+		return;
+	}
+
+	m_Statistics.wasteCount += m_BufferCount - m_UsedCount;
+
+	if (m_UsedCount == m_BufferCount) {
+		// 使い切ったのでもっと先まで読む
+		m_Depth *= 2;
+		if (m_Depth > SD_READ_AHEAD_SECTOR_COUNT) {
+			m_Depth = SD_READ_AHEAD_SECTOR_COUNT;
+		}
+	} else if (m_UsedCount * 2 < m_BufferCount) {
+		// 半分も使われなかったので読みすぎ
+		m_Depth /= 2;
+		if (m_Depth < SD_READ_AHEAD_DEPTH_MIN) {
+			m_Depth = SD_READ_AHEAD_DEPTH_MIN;
+		}
+	}
+
+	m_BufferCount = 0;
+	m_UsedCount = 0;
+}
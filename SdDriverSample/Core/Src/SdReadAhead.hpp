@@ -0,0 +1,80 @@
+#ifndef SD_READ_AHEAD_HPP
+#define SD_READ_AHEAD_HPP
+
+#include "SdDriver.hpp"
+
+// 先読みバッファのセクタ数 (RAM を 512 バイト x この値だけ使う)
+// 先読みの深さはこの値を上限に適応的に変わる。
+#ifndef SD_READ_AHEAD_SECTOR_COUNT
+#define SD_READ_AHEAD_SECTOR_COUNT	4
+#endif
+
+// 先読みの深さの下限
+#ifndef SD_READ_AHEAD_DEPTH_MIN
+#define SD_READ_AHEAD_DEPTH_MIN		2
+#endif
+
+// 何回連続した LBA を読んだら先読みを始めるか
+#ifndef SD_READ_AHEAD_TRIGGER
+#define SD_READ_AHEAD_TRIGGER		2
+#endif
+
+// ----------------------------------------------------------------------
+//  連続読み出しの検出と先読み
+// ----------------------------------------------------------------------
+// lba, lba+1, lba+2 ... と 1 セクタずつ読まれていることを検出したら、
+// 次の数セクタを 1 回の CMD18 でバッファに読んでおき、以降はバッファから返す。
+// CMD17 を繰り返す場合と比べて、コマンドとデータ開始トークン待ちが先読み 1 回分で済む。
+//
+// 先読みの深さは、捨てたバッファをどれだけ使い切ったかで調整する。
+// 全部使われていれば倍に、半分も使われていなければ半分にする
+// (SD_READ_AHEAD_DEPTH_MIN - SD_READ_AHEAD_SECTOR_COUNT)。
+//
+// SdDriver::SetReadAhead() で登録しておくと、ドライバへの書き込み/消去で
+// 該当するバッファが破棄される。
+class SdReadAhead
+{
+public:
+	struct Statistics {
+		uint32_t hitCount;			// バッファから返したセクタ数
+		uint32_t missCount;			// カードから読んだセクタ数 (先読みの先頭を含む)
+		uint32_t prefetchCount;		// 先読み (CMD18) の回数
+		uint32_t wasteCount;		// 先読みしたが使われずに捨てたセクタ数
+	};
+
+private:
+	SdDriver *m_pDriver;
+	Statistics m_Statistics;
+
+	// 次に読まれると予想する LBA と、そこまで連続して読まれた回数
+	uint32_t m_NextSector;
+	uint32_t m_SequentialCount;
+
+	// 先読みの深さ [セクタ]
+	uint32_t m_Depth;
+
+	// バッファの内容 [m_BufferStart, m_BufferStart + m_BufferCount)
+	// m_UsedCount は先頭から何セクタ目までが読まれたか
+	uint32_t m_BufferStart;
+	uint32_t m_BufferCount;
+	uint32_t m_UsedCount;
+	uint8_t m_Buffer[SD_READ_AHEAD_SECTOR_COUNT][SD::SECTOR_SIZE];
+
+public:
+	SdReadAhead(SdDriver *pDriver);
+
+	const Statistics &GetStatistics() const;
+	uint32_t GetDepth() const;
+
+	// 1 セクタ読み出し (SdDriver::ReadSector() の代わりに呼ぶ)
+	SD::Result Read(uint8_t *pOutBuffer, uint32_t sectorIndex);
+
+	// [sectorIndex, sectorIndex + count) を含むバッファを破棄する
+	void Invalidate(uint32_t sectorIndex, uint32_t count);
+
+private:
+	// バッファを捨てる前に使われ方から深さを調整する
+	void Discard();
+};
+
+#endif /* SD_READ_AHEAD_HPP */
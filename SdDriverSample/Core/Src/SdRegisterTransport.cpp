@@ -0,0 +1,113 @@
+#include "SdRegisterTransport.hpp"
+#include "SdSpiRegister.hpp"
+
+// ----------------------------------------------------------------------
+//  static private functions
+// ----------------------------------------------------------------------
+namespace {
+
+// 送信済みで未読み出しのバイト数の上限
+// 受信 FIFO (32bit = 4 バイト) をあふれさせない (OVR にしない) ための制限
+constexpr uint32_t InFlightMax = 4;
+
+// SetClock() や CRC 計算ユニットの設定で SPE が落とされているので立て直す
+inline void EnableSpi(SPI_TypeDef *spi)
+{
+	if ((spi->CR1 & SPI_CR1_SPE) == 0) {
+		SET_BIT(spi->CR1, SPI_CR1_SPE);
+	}
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------
+//  class public methods
+// ----------------------------------------------------------------------
+SdRegisterTransport::SdRegisterTransport(SPI_HandleTypeDef *spi, GPIO_TypeDef *csPort, uint16_t csPin)
+	: SdSpiTransport(spi, csPort, csPin)
+{
+}
+
+const char *SdRegisterTransport::GetName() const
+{
+	return "Reg";
+}
+
+uint8_t SdRegisterTransport::Exchange(uint8_t txData)
+{
+	SPI_TypeDef *spi = m_Spi->Instance;
+
+	EnableSpi(spi);
+	// 8bit (1 フレーム) 受信で RXNE を立てる
+	if ((spi->CR2 & SPI_CR2_FRXTH) == 0) {
+		SET_BIT(spi->CR2, SPI_CR2_FRXTH);
+	}
+
+	while (!SdSpiRegister::IsTxEmpty(spi)) {
+		;
+	}
+	SdSpiRegister::WriteData8(spi, txData);
+	while (!SdSpiRegister::IsRxNotEmpty(spi)) {
+		;
+	}
+	return SdSpiRegister::ReadData8(spi);
+}
+
+void SdRegisterTransport::Send(const uint8_t *pData, uint32_t size)
+{
+	Transfer<true, false>(pData, nullptr, size);
+}
+
+void SdRegisterTransport::Receive(uint8_t *pOutData, uint32_t size)
+{
+	Transfer<false, true>(nullptr, pOutData, size);
+}
+
+// ----------------------------------------------------------------------
+//  class private methods
+// ----------------------------------------------------------------------
+/**
+ * 2 バイト単位にパッキングして送受信する (端数の 1 バイトは Exchange() で送受信する)
+ * @tparam HasTxData false なら 0xFF を送信する
+ * @tparam HasRxData false なら受信データを捨てる (FIFO は必ず読み出す)
+ */
+template <bool HasTxData, bool HasRxData>
+void SdRegisterTransport::Transfer(const uint8_t *pTxData, uint8_t *pRxData, uint32_t size)
+{
+	SPI_TypeDef *spi = m_Spi->Instance;
+
+	EnableSpi(spi);
+	// 16bit (2 フレーム) 受信で RXNE を立てる
+	CLEAR_BIT(spi->CR2, SPI_CR2_FRXTH);
+
+	const uint32_t packedSize = size & ~1UL;
+	uint32_t txCount = 0;
+	uint32_t rxCount = 0;
+
+	while (rxCount < packedSize) {
+		// 受信を待たずに送信 FIFO を先に埋めておくことでバイト間の隙間をなくす
+		if ((txCount < packedSize) && ((txCount - rxCount) < InFlightMax) && SdSpiRegister::IsTxEmpty(spi)) {
+			uint16_t txData = 0xFFFF;
+			if (HasTxData) {
+				txData = static_cast<uint16_t>(pTxData[txCount] | (pTxData[txCount + 1] << 8));
+			}
+			SdSpiRegister::WriteData16(spi, txData);
+			txCount += 2;
+		}
+		if (SdSpiRegister::IsRxNotEmpty(spi)) {
+			uint16_t rxData = SdSpiRegister::ReadData16(spi);
+			if (HasRxData) {
+				pRxData[rxCount]     = static_cast<uint8_t>(rxData);
+				pRxData[rxCount + 1] = static_cast<uint8_t>(rxData >> 8);
+			}
+			rxCount += 2;
+		}
+	}
+
+	if (packedSize != size) {
+		uint8_t rxData = Exchange(HasTxData ? pTxData[packedSize] : 0xFF);
+		if (HasRxData) {
+			pRxData[packedSize] = rxData;
+		}
+	}
+}
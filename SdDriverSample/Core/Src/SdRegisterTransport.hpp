@@ -0,0 +1,32 @@
+#ifndef SD_REGISTER_TRANSPORT_HPP
+#define SD_REGISTER_TRANSPORT_HPP
+
+#include "SdSpiTransport.hpp"
+
+// ----------------------------------------------------------------------
+//  SPI のレジスタを直接操作する通信路
+// ----------------------------------------------------------------------
+// HAL_SPI_TransmitReceive() は呼び出し毎の状態確認やロック、タイムアウト処理が重く、
+// 高い SPI クロックではバイト間に隙間ができる。
+// ここでは DR/SR を直接操作し、まとまった転送は 32bit の FIFO に
+// 16bit (2 フレーム) 単位で詰めて (FRXTH = 0) 送受信する。
+//
+// CS 制御、クロック設定、CRC 計算ユニットの制御は HAL 版と共通。
+// HAL の転送関数と混在させてよい (HAL 側は呼び出し毎に SPE/FRXTH を設定し直す)。
+class SdRegisterTransport : public SdSpiTransport
+{
+public:
+	SdRegisterTransport(SPI_HandleTypeDef *spi, GPIO_TypeDef *csPort, uint16_t csPin);
+
+	const char *GetName() const override;
+
+	uint8_t Exchange(uint8_t txData) override;
+	void Send(const uint8_t *pData, uint32_t size) override;
+	void Receive(uint8_t *pOutData, uint32_t size) override;
+
+private:
+	template <bool HasTxData, bool HasRxData>
+	void Transfer(const uint8_t *pTxData, uint8_t *pRxData, uint32_t size);
+};
+
+#endif /* SD_REGISTER_TRANSPORT_HPP */
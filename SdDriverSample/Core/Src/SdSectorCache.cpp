@@ -0,0 +1,116 @@
+#include "SdSectorCache.hpp"
+#include <cstring>
+
+// ----------------------------------------------------------------------
+//  class public methods
+// ----------------------------------------------------------------------
+SdSectorCache::SdSectorCache(SdDriver *pDriver)
+	: m_pDriver(pDriver)
+	, m_Statistics()
+	, m_UseClock(0)
+{
+	ASSERT(pDriver != nullptr);
+
+	// CCMRAM に置かれた場合は 0 クリアされていないのですべて明示的に初期化する
+	InvalidateAll();
+}
+
+const SdSectorCache::Statistics &SdSectorCache::GetStatistics() const
+{
+	return m_Statistics;
+}
+
+SD::Result SdSectorCache::Read(uint8_t *pOutBuffer, uint32_t sectorIndex)
+{
+	if (pOutBuffer == nullptr) {
+		return SD::Result::InvalidArgument;
+	}
+
+	uint32_t entry = FindEntry(sectorIndex);
+	if (entry != SD_SECTOR_CACHE_ENTRY_COUNT) {
+		memcpy(pOutBuffer, m_Data[entry], SD::SECTOR_SIZE);
+		Touch(entry);
+		m_Statistics.hitCount++;
+		return SD::Result::Ok;
+	}
+
+	// エントリは DMA から見えないので呼び出し元のバッファに読んでからコピーする
+	m_Statistics.missCount++;
+	SD::Result result = m_pDriver->ReadSector(pOutBuffer, sectorIndex);
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	entry = FindVictim();
+	memcpy(m_Data[entry], pOutBuffer, SD::SECTOR_SIZE);
+	m_SectorIndex[entry] = sectorIndex;
+	Touch(entry);
+
+	return SD::Result::Ok;
+}
+
+void SdSectorCache::Invalidate(uint32_t sectorIndex, uint32_t count)
+{
+	for (uint32_t i = 0; i < SD_SECTOR_CACHE_ENTRY_COUNT; i++) {
+		if ((m_LastUse[i] != 0) && (m_SectorIndex[i] >= sectorIndex) && (m_SectorIndex[i] - sectorIndex < count)) {
+			m_LastUse[i] = 0;
+			m_Statistics.invalidateCount++;
+		}
+	}
+}
+
+void SdSectorCache::InvalidateAll()
+{
+	for (uint32_t i = 0; i < SD_SECTOR_CACHE_ENTRY_COUNT; i++) {
+		m_LastUse[i] = 0;
+		m_SectorIndex[i] = 0;
+	}
+}
+
+// ----------------------------------------------------------------------
+//  class private methods
+// ----------------------------------------------------------------------
+uint32_t SdSectorCache::FindEntry(uint32_t sectorIndex) const
+{
+	for (uint32_t i = 0; i < SD_SECTOR_CACHE_ENTRY_COUNT; i++) {
+		if ((m_LastUse[i] != 0) && (m_SectorIndex[i] == sectorIndex)) {
+			return i;
+		}
+	}
+	return SD_SECTOR_CACHE_ENTRY_COUNT;
+}
+
+uint32_t SdSectorCache::FindVictim() const
+{
+	uint32_t victim = 0;
+	for (uint32_t i = 0; i < SD_SECTOR_CACHE_ENTRY_COUNT; i++) {
+		if (m_LastUse[i] < m_LastUse[victim]) {
+			victim = i;
+		}
+	}
+	return victim;
+}
+
+void SdSectorCache::Touch(uint32_t entry)
+{
+	m_UseClock++;
+	if (m_UseClock == 0) {
+		// 一周したら古い順に 1, 2, ... と振り直す (エントリ数が少ないので単純に数える)
+		uint32_t rank[SD_SECTOR_CACHE_ENTRY_COUNT];
+		for (uint32_t i = 0; i < SD_SECTOR_CACHE_ENTRY_COUNT; i++) {
+			rank[i] = 0;
+			if (m_LastUse[i] == 0) {
+				continue;
+			}
+			rank[i] = 1;
+			for (uint32_t j = 0; j < SD_SECTOR_CACHE_ENTRY_COUNT; j++) {
+				if ((m_LastUse[j] != 0) && (m_LastUse[j] < m_LastUse[i])) {
+					rank[i]++;
+				}
+			}
+		}
+		memcpy(m_LastUse, rank, sizeof(m_LastUse));
+		m_UseClock = SD_SECTOR_CACHE_ENTRY_COUNT + 1;
+	}
+	m_LastUse[entry] = m_UseClock;
+}
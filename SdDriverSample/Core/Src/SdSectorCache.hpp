@@ -0,0 +1,76 @@
+#ifndef SD_SECTOR_CACHE_HPP
+#define SD_SECTOR_CACHE_HPP
+
+#include "SdDriver.hpp"
+
+// キャッシュするセクタ数 (512 バイト x この値)
+// CCMRAM (4KB) に置く場合は管理情報と合わせて収まる 7 が上限。
+#ifndef SD_SECTOR_CACHE_ENTRY_COUNT
+#define SD_SECTOR_CACHE_ENTRY_COUNT	7
+#endif
+
+// CCMRAM (0x10000000-0x10000FFF) に置く変数に付ける
+// .ccmram は NOLOAD なので起動時に 0 クリアされない (初期化はコンストラクタで行うこと)。
+#ifdef SD_HOST_SIMULATOR
+#define SD_CCMRAM
+#else
+#define SD_CCMRAM	__attribute__((section(".ccmram")))
+#endif
+
+// ----------------------------------------------------------------------
+//  LRU セクタキャッシュ
+// ----------------------------------------------------------------------
+// ブートセクタ、FAT、ディレクトリのように同じセクタを何度も読む場合に、
+// 最近読んだ数セクタを RAM に残しておき、CMD17 を発行せずに返す。
+// 連続読み出し (ファイルの中身) は SdReadAhead を使い、こちらには通さないこと
+// (すぐに追い出されるので効果がないうえ、よく使うセクタまで追い出してしまう)。
+//
+// 空いている CCMRAM に置けるように、エントリへの読み書きはすべて CPU の memcpy で行う。
+// CCMRAM は CPU (D-Bus) からしかアクセスできず DMA からは見えないので、
+//   - ミス時は呼び出し元のバッファ (通常の RAM) に読んでからエントリにコピーする
+//   - エントリのアドレスを SdDriver/SdTransport に渡してはいけない
+//   - Read() の pOutBuffer を CCMRAM に置く場合は DMA の通信路を使わないこと
+// (SdDmaTransport は CCMRAM のバッファを渡されると ASSERT で止まる)
+//
+// SdDriver::SetSectorCache() で登録しておくと、ドライバへの書き込み/消去で
+// 該当するエントリが破棄される。
+class SdSectorCache
+{
+public:
+	struct Statistics {
+		uint32_t hitCount;
+		uint32_t missCount;
+		uint32_t invalidateCount;	// 書き込み/消去で破棄したエントリ数
+	};
+
+private:
+	SdDriver *m_pDriver;
+	Statistics m_Statistics;
+
+	// 最後に使った順序 (大きいほど新しい、0 は空きエントリ)
+	uint32_t m_UseClock;
+	uint32_t m_LastUse[SD_SECTOR_CACHE_ENTRY_COUNT];
+	uint32_t m_SectorIndex[SD_SECTOR_CACHE_ENTRY_COUNT];
+	uint8_t m_Data[SD_SECTOR_CACHE_ENTRY_COUNT][SD::SECTOR_SIZE];
+
+public:
+	SdSectorCache(SdDriver *pDriver);
+
+	const Statistics &GetStatistics() const;
+
+	// 1 セクタ読み出し (SdDriver::ReadSector() の代わりに呼ぶ)
+	SD::Result Read(uint8_t *pOutBuffer, uint32_t sectorIndex);
+
+	// [sectorIndex, sectorIndex + count) のエントリを破棄する
+	void Invalidate(uint32_t sectorIndex, uint32_t count);
+	void InvalidateAll();
+
+private:
+	// 見つからなければ SD_SECTOR_CACHE_ENTRY_COUNT を返す
+	uint32_t FindEntry(uint32_t sectorIndex) const;
+	// 空きエントリ、なければ最も長く使われていないエントリ
+	uint32_t FindVictim() const;
+	void Touch(uint32_t entry);
+};
+
+#endif /* SD_SECTOR_CACHE_HPP */
@@ -0,0 +1,238 @@
+#include "SdSpiTransport.hpp"
+#include "SdLog.hpp"
+#include <cstdint>
+#include <cstring>
+
+// ----------------------------------------------------------------------
+//  static private functions
+// ----------------------------------------------------------------------
+namespace {
+
+// Busy 待ち中の MISO ピン (待っていなければ 0)
+volatile uint16_t g_BusyWaitPin = 0;
+// MISO の立ち上がり (Busy 解除) で立てる
+volatile bool g_IsBusyReleased = false;
+
+} // namespace
+
+// ----------------------------------------------------------------------
+//  class public methods
+// ----------------------------------------------------------------------
+SdSpiTransport::SdSpiTransport(SPI_HandleTypeDef *spi, GPIO_TypeDef *csPort, uint16_t csPin)
+	: m_Spi(spi)
+	, m_CsPort(csPort)
+	, m_CsPin(csPin)
+	, m_MisoPort(nullptr)
+	, m_MisoPin(0)
+	, m_MisoAlternate(0)
+{
+}
+
+void SdSpiTransport::SetBusyInterruptPin(GPIO_TypeDef *misoPort, uint16_t misoPin, uint32_t misoAlternate)
+{
+	m_MisoPort = misoPort;
+	m_MisoPin = misoPin;
+	m_MisoAlternate = misoAlternate;
+}
+
+const char *SdSpiTransport::GetName() const
+{
+	return "HAL";
+}
+
+void SdSpiTransport::Select()
+{
+	HAL_GPIO_WritePin(m_CsPort, m_CsPin, GPIO_PIN_RESET);
+}
+
+void SdSpiTransport::Deselect()
+{
+	HAL_GPIO_WritePin(m_CsPort, m_CsPin, GPIO_PIN_SET);
+}
+
+/**
+ * SPI クロックを指定クロック以下の最大値に設定する
+ * @param maxClock 最大クロック [Hz]
+ * @return 設定後のクロック [Hz]
+ */
+uint32_t SdSpiTransport::SetClock(uint32_t maxClock)
+{
+	// 分周比 2, 4, 8, ... 256
+	static const uint32_t Prescalers[8] = {
+		SPI_BAUDRATEPRESCALER_2,
+		SPI_BAUDRATEPRESCALER_4,
+		SPI_BAUDRATEPRESCALER_8,
+		SPI_BAUDRATEPRESCALER_16,
+		SPI_BAUDRATEPRESCALER_32,
+		SPI_BAUDRATEPRESCALER_64,
+		SPI_BAUDRATEPRESCALER_128,
+		SPI_BAUDRATEPRESCALER_256,
+	};
+
+	// SPI1 は APB2 (PCLK2) に接続されている
+	const uint32_t pclk = HAL_RCC_GetPCLK2Freq();
+
+	uint32_t index = 0;
+	while ((index < 7) && ((pclk >> (index + 1)) > maxClock)) {
+		index++;
+	}
+
+	// BR は SPI 無効時にしか変更できない
+	// (有効化は次回の HAL 転送関数の呼び出し時に行われる)
+	__HAL_SPI_DISABLE(m_Spi);
+	MODIFY_REG(m_Spi->Instance->CR1, SPI_CR1_BR, Prescalers[index]);
+	m_Spi->Init.BaudRatePrescaler = Prescalers[index];
+
+	return pclk >> (index + 1);
+}
+
+uint8_t SdSpiTransport::Exchange(uint8_t txData)
+{
+	uint8_t rxData;
+	if (HAL_SPI_TransmitReceive(m_Spi, &txData, &rxData, 1, SD_SPI_HAL_TIMEOUT_MS) != HAL_OK) {
+		OnHalError();
+		// 応答待ちのループが無応答 (0xFF) として抜けられるようにする
+		return 0xFF;
+	}
+	return rxData;
+}
+
+void SdSpiTransport::Send(const uint8_t *pData, uint32_t size)
+{
+	// HAL の API が const を受け付けないので外す (送信のみで書き換えられることはない)
+	if (HAL_SPI_Transmit(m_Spi, const_cast<uint8_t*>(pData), size, SD_SPI_HAL_TIMEOUT_MS) != HAL_OK) {
+		OnHalError();
+	}
+}
+
+void SdSpiTransport::Receive(uint8_t *pOutData, uint32_t size)
+{
+	// HAL_SPI_Receive() だと 0xFF 以外のデータが送信されてしまうので
+	// HAL_SPI_TransmitReceive() を使用する必要がある。
+	// 送信用のダミーバッファは持たず、受信バッファを 0xFF で埋めて送信元を兼ねる
+	// (i バイト目を受信するのは i バイト目を送信した後なので、送信前に上書きされることはない)。
+	std::memset(pOutData, 0xFF, size);
+	while (size > 0) {
+		uint16_t chunk = (size < UINT16_MAX) ? static_cast<uint16_t>(size) : UINT16_MAX;
+		if (HAL_SPI_TransmitReceive(m_Spi, pOutData, pOutData, chunk, SD_SPI_HAL_TIMEOUT_MS) != HAL_OK) {
+			OnHalError();
+			return;
+		}
+		pOutData += chunk;
+		size -= chunk;
+	}
+}
+
+bool SdSpiTransport::IsHardwareCrcSupported() const
+{
+	return true;
+}
+
+// CRC16-CCITT (x^16 + x^12 + x^5 + 1) で CRC 計算ユニットを有効にする
+// CRCEN を立て直すことで CRC 値もリセットされる
+void SdSpiTransport::BeginHardwareCrc()
+{
+	// CRCEN/CRCL/CRCPR は SPI 無効時にしか変更できない
+	// (有効化は次回の HAL 転送関数の呼び出し時に行われる)
+	__HAL_SPI_DISABLE(m_Spi);
+	WRITE_REG(m_Spi->Instance->CRCPR, 0x1021);
+	CLEAR_BIT(m_Spi->Instance->CR1, SPI_CR1_CRCEN);
+	SET_BIT(m_Spi->Instance->CR1, SPI_CR1_CRCL | SPI_CR1_CRCEN);
+}
+
+// CRC の送受信は自前で行うので HAL の CRC 処理 (USE_SPI_CRC) は使わない
+uint16_t SdSpiTransport::EndHardwareCrc(bool isReceive)
+{
+	uint16_t crc = static_cast<uint16_t>(isReceive ?
+		READ_REG(m_Spi->Instance->RXCRCR) :
+		READ_REG(m_Spi->Instance->TXCRCR));
+
+	__HAL_SPI_DISABLE(m_Spi);
+	CLEAR_BIT(m_Spi->Instance->CR1, SPI_CR1_CRCL | SPI_CR1_CRCEN);
+
+	return crc;
+}
+
+void SdSpiTransport::OnExtiInterrupt(uint16_t pin)
+{
+	if ((pin & g_BusyWaitPin) != 0) {
+		g_IsBusyReleased = true;
+	}
+}
+
+bool SdSpiTransport::IsBusyInterruptSupported() const
+{
+	return m_MisoPort != nullptr;
+}
+
+/**
+ * MISO を EXTI の立ち上がり入力に切り替え、カードが DO ラインを Hi に戻すまで眠る
+ * 直前の Exchange() で転送は終わっているので SCK は止まっており、切り替えてもカードには見えない。
+ * @param timeoutMs タイムアウト [ms] (SysTick で起きるたびに確認する)
+ * @return タイムアウトした場合は false
+ */
+bool SdSpiTransport::WaitBusyInterrupt(uint32_t timeoutMs)
+{
+	if (m_MisoPort == nullptr) {
+		return false;
+	}
+
+	g_IsBusyReleased = false;
+	g_BusyWaitPin = m_MisoPin;
+	ConfigureMisoPin(GPIO_MODE_IT_RISING);
+	__HAL_GPIO_EXTI_CLEAR_IT(m_MisoPin);
+
+	// 切り替える前に解除されていた場合は立ち上がりが来ないので、ピンの状態も見る
+	bool isReleased = true;
+	if (HAL_GPIO_ReadPin(m_MisoPort, m_MisoPin) == GPIO_PIN_RESET) {
+		const uint32_t startTick = HAL_GetTick();
+
+		// SdDmaTransport::WaitComplete() と同じく、フラグ確認から WFI までの間の割り込みも取りこぼさない
+		__disable_irq();
+		while (!g_IsBusyReleased) {
+			if ((HAL_GetTick() - startTick) > timeoutMs) {
+				isReleased = false;
+				break;
+			}
+			__WFI();
+			__enable_irq();
+			__disable_irq();
+		}
+		__enable_irq();
+	}
+
+	ConfigureMisoPin(GPIO_MODE_AF_PP);
+	g_BusyWaitPin = 0;
+
+	return isReleased;
+}
+
+// ----------------------------------------------------------------------
+//  class protected methods
+// ----------------------------------------------------------------------
+// HAL の転送関数が失敗した (タイムアウトなど)
+// エラーを記録して呼び出し元に戻る。確認は SdDriver が転送の区切りごとに行う。
+void SdSpiTransport::OnHalError()
+{
+	SD_LOG_ERROR("[SD] Error: %s Transfer Error (0x%08lX).\n", GetName(), m_Spi->ErrorCode);
+	SetError();
+}
+
+// ----------------------------------------------------------------------
+//  class private methods
+// ----------------------------------------------------------------------
+void SdSpiTransport::ConfigureMisoPin(uint32_t mode)
+{
+	// HAL_GPIO_Init() は AF に戻しても EXTI の設定を消さないので、先に DeInit で消しておく
+	if (mode != GPIO_MODE_IT_RISING) {
+		HAL_GPIO_DeInit(m_MisoPort, m_MisoPin);
+	}
+
+	GPIO_InitTypeDef init = {};
+	init.Pin = m_MisoPin;
+	init.Mode = mode;
+	init.Pull = GPIO_NOPULL;
+	init.Speed = GPIO_SPEED_FREQ_HIGH;
+	init.Alternate = m_MisoAlternate;
+	HAL_GPIO_Init(m_MisoPort, &init);
+}
@@ -0,0 +1,67 @@
+#ifndef SD_SPI_TRANSPORT_HPP
+#define SD_SPI_TRANSPORT_HPP
+
+#include "main.h"
+#include "stm32f3xx_hal_spi.h"
+#include "SdTransport.hpp"
+
+// HAL のポーリング転送 1 回あたりのタイムアウト [ms]
+// 最低クロック (PCLK2 / 256 = 125kHz) で 512 バイト転送しても 33ms で終わる。
+// カードの応答待ちのタイムアウトは SdDriver 側で別に管理している。
+#ifndef SD_SPI_HAL_TIMEOUT_MS
+#define SD_SPI_HAL_TIMEOUT_MS	100
+#endif
+
+// ----------------------------------------------------------------------
+//  HAL のポーリング転送による SPI 通信路
+// ----------------------------------------------------------------------
+class SdSpiTransport : public SdTransport
+{
+protected:
+	SPI_HandleTypeDef *m_Spi;
+	GPIO_TypeDef *m_CsPort;
+	uint16_t m_CsPin;
+
+	// Busy 待ちの間だけ EXTI の入力に切り替える MISO ピンと、SPI に戻すときの AF
+	GPIO_TypeDef *m_MisoPort;
+	uint16_t m_MisoPin;
+	uint32_t m_MisoAlternate;
+
+public:
+	SdSpiTransport(SPI_HandleTypeDef *spi, GPIO_TypeDef *csPort, uint16_t csPin);
+
+	// WaitBusyInterrupt() を使えるようにする (例: GPIOA, GPIO_PIN_6, GPIO_AF5_SPI1)
+	// ピンの EXTI ライン (EXTI9_5_IRQn など) の割り込みを有効にしておき、
+	// ハンドラから HAL_GPIO_EXTI_IRQHandler() を呼ぶこと。
+	void SetBusyInterruptPin(GPIO_TypeDef *misoPort, uint16_t misoPin, uint32_t misoAlternate);
+
+	// アプリケーションの HAL_GPIO_EXTI_Callback() から呼ぶ (Busy 待ち中の MISO 以外は無視する)
+	// 割り込みコンテキストから呼ばれる。
+	static void OnExtiInterrupt(uint16_t pin);
+
+	const char *GetName() const override;
+
+	void Select() override;
+	void Deselect() override;
+	uint32_t SetClock(uint32_t maxClock) override;
+
+	uint8_t Exchange(uint8_t txData) override;
+	void Send(const uint8_t *pData, uint32_t size) override;
+	void Receive(uint8_t *pOutData, uint32_t size) override;
+
+	bool IsHardwareCrcSupported() const override;
+	void BeginHardwareCrc() override;
+	uint16_t EndHardwareCrc(bool isReceive) override;
+
+	bool IsBusyInterruptSupported() const override;
+	bool WaitBusyInterrupt(uint32_t timeoutMs) override;
+
+protected:
+	void OnHalError();
+
+private:
+	// mode: GPIO_MODE_IT_RISING (Busy 待ち) / GPIO_MODE_AF_PP (SPI の MISO)
+	void ConfigureMisoPin(uint32_t mode);
+};
+
+#endif /* SD_SPI_TRANSPORT_HPP */
@@ -0,0 +1,36 @@
+#ifndef SD_TIMER_HPP
+#define SD_TIMER_HPP
+
+#include "main.h"
+#include <cstdint>
+
+// ----------------------------------------------------------------------
+//  DWT サイクルカウンタによる時間計測
+// ----------------------------------------------------------------------
+// HAL_GetTick() は 1ms 単位なので、コマンド 1 回分の時間計測には粗すぎる。
+// CYCCNT は 32bit なので、SYSCLK 32MHz では約 134 秒で一周する。
+// (差分を取る限りは一周しても正しく求まる)
+namespace SdTimer {
+
+static inline void EnableCycleCounter()
+{
+	if ((DWT->CTRL & DWT_CTRL_CYCCNTENA_Msk) == 0) {
+		CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+		DWT->CYCCNT = 0;
+		DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+	}
+}
+
+static inline uint32_t GetCycles()
+{
+	return DWT->CYCCNT;
+}
+
+static inline uint32_t CyclesToMicroseconds(uint64_t cycles)
+{
+	return static_cast<uint32_t>(cycles / (SystemCoreClock / 1000000));
+}
+
+}
+
+#endif /* SD_TIMER_HPP */
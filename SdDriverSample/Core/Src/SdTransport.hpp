@@ -0,0 +1,77 @@
+#ifndef SD_TRANSPORT_HPP
+#define SD_TRANSPORT_HPP
+
+#include <cstdint>
+
+// ----------------------------------------------------------------------
+//  SD カードとの SPI 通信路
+// ----------------------------------------------------------------------
+// SdDriver はカードとのやり取りをすべてこのインターフェース経由で行う。
+// 実装 (バックエンド) ごとに単独で最適化・計測できるようにするためのもの。
+//
+//   SdSpiTransport      : HAL のポーリング転送
+//   SdRegisterTransport : SPI のレジスタを直接操作 (FIFO に 16bit 単位で詰める)
+//   SdDmaTransport      : データブロックを DMA で転送
+//   (ホスト)            : SD カードシミュレータ (Host/SimulatorTransport)
+class SdTransport
+{
+private:
+	// 転送エラー (HAL のタイムアウト、DMA の転送エラーなど) が起きた
+	bool m_HasError;
+
+public:
+	SdTransport() : m_HasError(false) {}
+	virtual ~SdTransport() {}
+
+	// REPL などでの表示名
+	virtual const char *GetName() const = 0;
+
+	// CS 制御 (Select で CS=Lo)
+	virtual void Select() = 0;
+	virtual void Deselect() = 0;
+
+	// maxClock [Hz] 以下で最も速い SPI クロックに設定し、実際のクロックを返す
+	virtual uint32_t SetClock(uint32_t maxClock) = 0;
+
+	// 1 バイト送受信 (応答待ちなどのポーリング用)
+	virtual uint8_t Exchange(uint8_t txData) = 0;
+
+	// 送信のみ (受信データは捨てる)
+	virtual void Send(const uint8_t *pData, uint32_t size) = 0;
+
+	// 0xFF を送信しながら受信する
+	virtual void Receive(uint8_t *pOutData, uint32_t size) = 0;
+
+	// Receive() を開始と完了待ちに分けたもの
+	// EndReceive() までの間、DMA の通信路は裏で受信を続けるので CPU は他の処理を進められる。
+	// その間は通信路の他のメソッドを呼ばないこと。既定の実装は BeginReceive() で受信を終える。
+	virtual void BeginReceive(uint8_t *pOutData, uint32_t size) { Receive(pOutData, size); }
+	virtual void EndReceive() {}
+	// BeginReceive() が受信を終えずに戻る (裏で受信が進む) か
+	virtual bool IsBackgroundReceiveSupported() const { return false; }
+
+	// SPI の CRC 計算ユニット (CRC16-CCITT)
+	// Begin から End までの間に送受信したデータの CRC を求める。
+	virtual bool IsHardwareCrcSupported() const { return false; }
+	virtual void BeginHardwareCrc() {}
+	// isReceive: true なら受信データ、false なら送信データの CRC を返す
+	virtual uint16_t EndHardwareCrc(bool isReceive) { (void)isReceive; return 0; }
+
+	// カードの Busy 解除 (DO ラインの立ち上がり) を割り込みで待つ
+	// 0xFF を送り続ける代わりにクロックを止めて CPU を眠らせる。CS を Lo にした状態で呼ぶこと。
+	// timeoutMs を過ぎても解除されなければ false を返す (解除の確認は呼び出し側で 0xFF を読んで行う)。
+	virtual bool IsBusyInterruptSupported() const { return false; }
+	virtual bool WaitBusyInterrupt(uint32_t timeoutMs) { (void)timeoutMs; return false; }
+
+	// 転送エラーの有無
+	// 転送が失敗しても各メソッドはそのまま戻る (受信データは 0xFF 扱い) ので、
+	// SdDriver は転送の区切りごとにここで確認し、SD::Result::TransportError にする。
+	// 一度立つと ClearError() まで立ったまま。
+	bool HasError() const { return m_HasError; }
+	void ClearError() { m_HasError = false; }
+
+protected:
+	void SetError() { m_HasError = true; }
+};
+
+#endif /* SD_TRANSPORT_HPP */
@@ -0,0 +1,219 @@
+#include "SdWriteCache.hpp"
+#include "SdReadAhead.hpp"
+#include <cstring>
+
+// ----------------------------------------------------------------------
+//  class public methods
+// ----------------------------------------------------------------------
+const SdWriteCache::Policy SdWriteCache::DefaultPolicy = {
+	/* flushThreshold   */ SD_WRITE_CACHE_SLOT_COUNT,
+	/* idleFlushDelayMs */ 100,
+};
+
+SdWriteCache::SdWriteCache(SdDriver *pDriver)
+	: m_pDriver(pDriver)
+	, m_Policy(DefaultPolicy)
+	, m_Statistics()
+	, m_Count(0)
+	, m_LastWriteTick(0)
+{
+	ASSERT(pDriver != nullptr);
+}
+
+void SdWriteCache::SetPolicy(const Policy &policy)
+{
+	ASSERT((policy.flushThreshold > 0) && (policy.flushThreshold <= SD_WRITE_CACHE_SLOT_COUNT));
+	m_Policy = policy;
+}
+
+const SdWriteCache::Statistics &SdWriteCache::GetStatistics() const
+{
+	return m_Statistics;
+}
+
+uint32_t SdWriteCache::GetDirtyCount() const
+{
+	return m_Count;
+}
+
+SD::Result SdWriteCache::Read(uint8_t *pOutBuffer, uint32_t sectorIndex, uint32_t count)
+{
+	if (pOutBuffer == nullptr) {
+		return SD::Result::InvalidArgument;
+	}
+	if (count == 0) {
+		return SD::Result::Ok;
+	}
+
+	// 範囲がすべてキャッシュにあればカードにアクセスしない
+	uint32_t first = FindSlot(sectorIndex);
+	uint32_t last = first + count;
+	if ((last <= m_Count) &&
+		(m_SectorIndex[first] == sectorIndex) &&
+		(m_SectorIndex[last - 1] == sectorIndex + count - 1)) {
+		memcpy(pOutBuffer, m_Data[first], count * SD::SECTOR_SIZE);
+		return SD::Result::Ok;
+	}
+
+	// 1 セクタずつの読み出しは先読みがあればそちらを通す
+	SdReadAhead *pReadAhead = m_pDriver->GetReadAhead();
+	SD::Result result;
+	if (count > 1) {
+		result = m_pDriver->ReadSector(pOutBuffer, sectorIndex, count);
+	} else if (pReadAhead != nullptr) {
+		result = pReadAhead->Read(pOutBuffer, sectorIndex);
+	} else {
+		result = m_pDriver->ReadSector(pOutBuffer, sectorIndex);
+	}
+	if (result != SD::Result::Ok) {
+		return result;
+	}
+
+	// カードの内容を書き出し待ちのデータで上書きする
+	for (uint32_t i = first; (i < m_Count) && (m_SectorIndex[i] - sectorIndex < count); i++) {
+		memcpy(&pOutBuffer[(m_SectorIndex[i] - sectorIndex) * SD::SECTOR_SIZE], m_Data[i], SD::SECTOR_SIZE);
+	}
+	return SD::Result::Ok;
+}
+
+SD::Result SdWriteCache::Write(const uint8_t *pBuffer, uint32_t sectorIndex, uint32_t count)
+{
+	if (pBuffer == nullptr) {
+		return SD::Result::InvalidArgument;
+	}
+	if (count == 0) {
+		return SD::Result::Ok;
+	}
+	if ((sectorIndex >= m_pDriver->GetSectorCount()) || (count > m_pDriver->GetSectorCount() - sectorIndex)) {
+		// 書き出し時ではなく受け付け時に失敗させる
+		return SD::Result::OutOfRange;
+	}
+
+	if (count >= SD_WRITE_CACHE_SLOT_COUNT) {
+		// 溜めても 1 回の CMD25 になるだけなので、古いデータを先に書き出してから直接書く
+		SD::Result result = Sync();
+		if (result != SD::Result::Ok) {
+			return result;
+		}
+		result = m_pDriver->WriteSector(pBuffer, sectorIndex, count);
+		if (result == SD::Result::Ok) {
+			m_Statistics.bypassCount += count;
+			m_Statistics.commandCount++;
+		}
+		return result;
+	}
+
+	// カードに書き出すまでの間も読み出しキャッシュに古い内容が残らないようにする
+	m_pDriver->InvalidateCaches(sectorIndex, count);
+
+	for (uint32_t i = 0; i < count; i++) {
+		SD::Result result = WriteOne(&pBuffer[i * SD::SECTOR_SIZE], sectorIndex + i);
+		if (result != SD::Result::Ok) {
+			return result;
+		}
+	}
+	m_LastWriteTick = HAL_GetTick();
+
+	if (m_Count >= m_Policy.flushThreshold) {
+		return Sync();
+	}
+	return SD::Result::Ok;
+}
+
+SD::Result SdWriteCache::Sync()
+{
+	SD::Result result = SD::Result::Ok;
+
+	// 書き出せなかったセクタを前に詰めて残す
+	uint32_t keptCount = 0;
+	uint32_t i = 0;
+	while (i < m_Count) {
+		// LBA が連続している範囲 [i, end) をまとめる
+		uint32_t end = i + 1;
+		while ((end < m_Count) && (m_SectorIndex[end] == m_SectorIndex[end - 1] + 1)) {
+			end++;
+		}
+		uint32_t runCount = end - i;
+
+		if (result == SD::Result::Ok) {
+			result = (runCount == 1) ?
+				m_pDriver->WriteSector(m_Data[i], m_SectorIndex[i]) :
+				m_pDriver->WriteSector(m_Data[i], m_SectorIndex[i], runCount);
+			if (result == SD::Result::Ok) {
+				m_Statistics.flushedCount += runCount;
+				m_Statistics.commandCount++;
+				i = end;
+				continue;
+			}
+			SD_LOG_ERROR("[Cache] Error: Failed to flush sector %lu (+%lu): %s.\n",
+				m_SectorIndex[i], runCount, SdDriver::GetResultName(result));
+		}
+
+		// 一度失敗したら以降は試さずに残す (失敗した原因を返すため)
+		if (keptCount != i) {
+			memmove(m_Data[keptCount], m_Data[i], runCount * SD::SECTOR_SIZE);
+			memmove(&m_SectorIndex[keptCount], &m_SectorIndex[i], runCount * sizeof(m_SectorIndex[0]));
+		}
+		keptCount += runCount;
+		i = end;
+	}
+	m_Count = keptCount;
+
+	return result;
+}
+
+void SdWriteCache::OnIdle()
+{
+	if ((m_Count == 0) || ((HAL_GetTick() - m_LastWriteTick) < m_Policy.idleFlushDelayMs)) {
+		return;
+	}
+	if (Sync() != SD::Result::Ok) {
+		// カードが回復するまで毎回試さないよう、次の書き出しは同じだけ待つ
+		m_LastWriteTick = HAL_GetTick();
+	}
+}
+
+// ----------------------------------------------------------------------
+//  class private methods
+// ----------------------------------------------------------------------
+uint32_t SdWriteCache::FindSlot(uint32_t sectorIndex) const
+{
+	// 追記が多いので後ろから探す
+	uint32_t i = m_Count;
+	while ((i > 0) && (m_SectorIndex[i - 1] >= sectorIndex)) {
+		i--;
+	}
+	return i;
+}
+
+SD::Result SdWriteCache::WriteOne(const uint8_t *pBuffer, uint32_t sectorIndex)
+{
+	m_Statistics.writeCount++;
+
+	uint32_t slot = FindSlot(sectorIndex);
+	if ((slot < m_Count) && (m_SectorIndex[slot] == sectorIndex)) {
+		// 書き出し前の上書きはカードへの書き込み 1 回分の節約になる
+		memcpy(m_Data[slot], pBuffer, SD::SECTOR_SIZE);
+		m_Statistics.mergeCount++;
+		return SD::Result::Ok;
+	}
+
+	if (m_Count == SD_WRITE_CACHE_SLOT_COUNT) {
+		SD::Result result = Sync();
+		if (result != SD::Result::Ok) {
+			return result;
+		}
+		slot = FindSlot(sectorIndex);
+	}
+
+	// LBA の昇順を保つように挿入する
+	if (slot < m_Count) {
+		memmove(m_Data[slot + 1], m_Data[slot], (m_Count - slot) * SD::SECTOR_SIZE);
+		memmove(&m_SectorIndex[slot + 1], &m_SectorIndex[slot], (m_Count - slot) * sizeof(m_SectorIndex[0]));
+	}
+	memcpy(m_Data[slot], pBuffer, SD::SECTOR_SIZE);
+	m_SectorIndex[slot] = sectorIndex;
+	m_Count++;
+
+	return SD::Result::Ok;
+}
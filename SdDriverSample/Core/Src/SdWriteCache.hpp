@@ -0,0 +1,80 @@
+#ifndef SD_WRITE_CACHE_HPP
+#define SD_WRITE_CACHE_HPP
+
+#include "SdDriver.hpp"
+
+// キャッシュできるセクタ数 (RAM を 512 バイト x この値だけ使う)
+#ifndef SD_WRITE_CACHE_SLOT_COUNT
+#define SD_WRITE_CACHE_SLOT_COUNT	4
+#endif
+
+// ----------------------------------------------------------------------
+//  ライトバック (write-behind) セクタキャッシュ
+// ----------------------------------------------------------------------
+// 書き込みをすぐにはカードに送らずスロットに溜めておき、
+// スロットが埋まったとき (しきい値)、Sync()、アイドル時にまとめて書き出す。
+// 書き出しでは LBA が連続するセクタを 1 回の CMD25 にまとめるので、
+// 小さな書き込みが続く場合 (ログなど) のコマンドと Busy 待ちのオーバーヘッドを減らせる。
+//
+// スロットは LBA の昇順に並べて持つので、連続する LBA はメモリ上でも連続しており
+// そのまま WriteSector() に渡せる。追記 (LBA の昇順の書き込み) では並べ替えは起きない。
+//
+// キャッシュしている範囲をドライバから直接読み書きすると内容が食い違うので、
+// Read()/Write() を経由するか、先に Sync() すること。
+class SdWriteCache
+{
+public:
+	struct Policy {
+		uint32_t flushThreshold;	// 溜まったセクタ数がこの値に達したら書き出す (1-SD_WRITE_CACHE_SLOT_COUNT)
+		uint32_t idleFlushDelayMs;	// 最後の書き込みからこの時間が経ったらアイドル時に書き出す
+	};
+
+	static const Policy DefaultPolicy;
+
+	struct Statistics {
+		uint32_t writeCount;		// Write() で受け付けたセクタ数
+		uint32_t mergeCount;		// 書き出し前に同じ LBA へ上書きされたセクタ数
+		uint32_t bypassCount;		// キャッシュを通さず直接書き込んだセクタ数
+		uint32_t flushedCount;		// 書き出したセクタ数
+		uint32_t commandCount;		// 書き出しに使った CMD24/CMD25 の数
+	};
+
+private:
+	SdDriver *m_pDriver;
+	Policy m_Policy;
+	Statistics m_Statistics;
+
+	// [0, m_Count) が書き出し待ちのセクタ (LBA の昇順)
+	uint32_t m_Count;
+	uint32_t m_SectorIndex[SD_WRITE_CACHE_SLOT_COUNT];
+	uint8_t m_Data[SD_WRITE_CACHE_SLOT_COUNT][SD::SECTOR_SIZE];
+
+	// 最後に Write() した時刻 (HAL_GetTick())
+	uint32_t m_LastWriteTick;
+
+public:
+	SdWriteCache(SdDriver *pDriver);
+
+	void SetPolicy(const Policy &policy);
+	const Statistics &GetStatistics() const;
+	// 書き出し待ちのセクタ数
+	uint32_t GetDirtyCount() const;
+
+	// 書き込み待ちのデータがあればそれを返し、なければカードから読む
+	SD::Result Read(uint8_t *pOutBuffer, uint32_t sectorIndex, uint32_t count = 1);
+	// スロット数以上のまとまった書き込みはキャッシュを通さず直接書き込む
+	SD::Result Write(const uint8_t *pBuffer, uint32_t sectorIndex, uint32_t count = 1);
+	// 書き出し待ちのセクタをすべて書き出す
+	// 失敗した場合は書き出せなかったセクタを残して原因を返す。
+	SD::Result Sync();
+
+	// SdDriver::OnIdle() から呼ばれる
+	void OnIdle();
+
+private:
+	// sectorIndex 以上の最初のスロットの添え字
+	uint32_t FindSlot(uint32_t sectorIndex) const;
+	SD::Result WriteOne(const uint8_t *pBuffer, uint32_t sectorIndex);
+};
+
+#endif /* SD_WRITE_CACHE_HPP */
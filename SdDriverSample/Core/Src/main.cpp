@@ -27,6 +27,12 @@
 #include <string.h>
 
 #include "SdDriver.hpp"
+#include "SdSpiTransport.hpp"
+#include "SdRegisterTransport.hpp"
+#include "SdDmaTransport.hpp"
+#include "SdWriteCache.hpp"
+#include "SdReadAhead.hpp"
+#include "SdSectorCache.hpp"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -45,8 +51,11 @@
 
 /* Private variables ---------------------------------------------------------*/
 SPI_HandleTypeDef hspi1;
+DMA_HandleTypeDef hdma_spi1_rx;
+DMA_HandleTypeDef hdma_spi1_tx;
 
 UART_HandleTypeDef huart2;
+DMA_HandleTypeDef hdma_usart2_tx;
 
 /* USER CODE BEGIN PV */
 /* USER CODE END PV */
@@ -54,6 +63,7 @@ UART_HandleTypeDef huart2;
 /* Private function prototypes -----------------------------------------------*/
 void SystemClock_Config(void);
 static void MX_GPIO_Init(void);
+static void MX_DMA_Init(void);
 static void MX_USART2_UART_Init(void);
 static void MX_SPI1_Init(void);
 /* USER CODE BEGIN PFP */
@@ -67,38 +77,234 @@ static void MX_SPI1_Init(void);
 #else
 #define PUTCHAR_PROTOTYPE int fputc(int ch, FILE *f)
 #endif /* __GNUC__ */
+
+// コンソール送信リングバッファのサイズ (2 のべき乗)
+#ifndef CONSOLE_TX_BUFFER_SIZE
+#define CONSOLE_TX_BUFFER_SIZE (1024)
+#endif
+static_assert((CONSOLE_TX_BUFFER_SIZE & (CONSOLE_TX_BUFFER_SIZE - 1)) == 0, "");
+
+// リングバッファが満杯の時の動作
+//   1: DMA が空きを作るまで待つ (出力は欠けない)
+//   0: 入りきらない文字を捨てる (printf は決してブロックしない)
+#ifndef CONSOLE_TX_BLOCK_ON_FULL
+#define CONSOLE_TX_BLOCK_ON_FULL (1)
+#endif
+
+namespace {
+
+uint8_t g_ConsoleTxBuffer[CONSOLE_TX_BUFFER_SIZE];
+// Head/Tail はラップさせずに増やし続け、添え字はマスクで求める
+volatile uint32_t g_ConsoleTxHead = 0;      // 次に書き込む位置
+volatile uint32_t g_ConsoleTxTail = 0;      // 送信完了済みの位置
+volatile uint32_t g_ConsoleTxSending = 0;   // DMA 転送中のバイト数 (0 なら停止中)
+volatile uint32_t g_ConsoleTxDropCount = 0; // 捨てた文字数
+
+// 未送信データがあれば DMA 転送を開始する
+// 割り込み禁止中または割り込みハンドラから呼ぶこと
+void ConsoleStartTransmit()
+{
+  if ((g_ConsoleTxSending != 0) || (g_ConsoleTxHead == g_ConsoleTxTail)) {
+    return;
+  }
+  uint32_t index = g_ConsoleTxTail & (CONSOLE_TX_BUFFER_SIZE - 1);
+  uint32_t length = g_ConsoleTxHead - g_ConsoleTxTail;
+  // バッファ末尾で折り返す分は次回の転送に回す
+  if (length > CONSOLE_TX_BUFFER_SIZE - index) {
+    length = CONSOLE_TX_BUFFER_SIZE - index;
+  }
+  g_ConsoleTxSending = length;
+  if (HAL_UART_Transmit_DMA(&huart2, &g_ConsoleTxBuffer[index], length) != HAL_OK) {
+    g_ConsoleTxSending = 0;
+  }
+}
+
+} // namespace
+
+extern "C" void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+  if (huart == &huart2) {
+    g_ConsoleTxTail = g_ConsoleTxTail + g_ConsoleTxSending;
+    g_ConsoleTxSending = 0;
+    ConsoleStartTransmit();
+  }
+}
+
 extern "C" PUTCHAR_PROTOTYPE
 {
-  /* Place your implementation of fputc here */
-  /* e.g. write a character to the USART1 and Loop until the end of transmission */
-  HAL_UART_Transmit(&huart2, (uint8_t *)&ch, 1, 0xFFFF);
+  while ((g_ConsoleTxHead - g_ConsoleTxTail) >= CONSOLE_TX_BUFFER_SIZE) {
+#if CONSOLE_TX_BLOCK_ON_FULL
+    // 割り込み禁止中は DMA 完了で空きができないので捨てるしかない
+    if (__get_PRIMASK() != 0) {
+      g_ConsoleTxDropCount = g_ConsoleTxDropCount + 1;
+      return ch;
+    }
+#else
+    g_ConsoleTxDropCount = g_ConsoleTxDropCount + 1;
+    return ch;
+#endif
+  }
+
+  g_ConsoleTxBuffer[g_ConsoleTxHead & (CONSOLE_TX_BUFFER_SIZE - 1)] = (uint8_t)ch;
+
+  uint32_t primask = __get_PRIMASK();
+  __disable_irq();
+  g_ConsoleTxHead = g_ConsoleTxHead + 1;
+  ConsoleStartTransmit();
+  __set_PRIMASK(primask);
 
   return ch;
 }
 
-// 同期型シリアル行単位読み込み (1 行読み込むまで戻らない)
-// 末尾の改行は除去済み
-extern "C" int ConsoleReadLine(uint8_t *pOutBuffer)
+// バッファ済みのコンソール出力をすべて送信し終えるまで待つ
+extern "C" void ConsoleFlush(void)
+{
+  fflush(stdout);
+  // 割り込み禁止中は送信完了を待てない
+  if (__get_PRIMASK() != 0) {
+    return;
+  }
+  while (g_ConsoleTxHead != g_ConsoleTxTail) {
+    // HAL がビジーで開始できなかった転送をここで再開する
+    __disable_irq();
+    ConsoleStartTransmit();
+    __enable_irq();
+  }
+}
+
+// 満杯で捨てた文字数
+extern "C" uint32_t ConsoleGetDropCount(void)
+{
+  return g_ConsoleTxDropCount;
+}
+
+// コンソール受信リングバッファのサイズ (2 のべき乗)
+// コマンドをまとめて貼り付けても溢れないよう、1 行よりも十分大きくしておく
+#ifndef CONSOLE_RX_BUFFER_SIZE
+#define CONSOLE_RX_BUFFER_SIZE (512)
+#endif
+static_assert((CONSOLE_RX_BUFFER_SIZE & (CONSOLE_RX_BUFFER_SIZE - 1)) == 0, "");
+
+// 1 行の最大長 (終端文字を含む)
+#ifndef CONSOLE_LINE_SIZE
+#define CONSOLE_LINE_SIZE (80)
+#endif
+
+namespace {
+
+uint8_t g_ConsoleRxByte;                    // 受信割り込み 1 回分の受け取り先
+uint8_t g_ConsoleRxBuffer[CONSOLE_RX_BUFFER_SIZE];
+volatile uint32_t g_ConsoleRxHead = 0;      // 割り込みが次に書き込む位置
+volatile uint32_t g_ConsoleRxTail = 0;      // 行編集が次に読み出す位置
+volatile uint32_t g_ConsoleRxDropCount = 0; // 満杯で捨てた文字数
+
+// 行編集中のバッファ
+char g_ConsoleLine[CONSOLE_LINE_SIZE];
+int g_ConsoleLineLength = 0;
+bool g_IsConsoleLineReady = false;
+uint8_t g_ConsoleLastChar = 0;
+
+void ConsoleStartReceive()
+{
+  HAL_UART_Receive_IT(&huart2, &g_ConsoleRxByte, 1);
+}
+
+} // namespace
+
+extern "C" void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
 {
-  static uint8_t buffer[80];
-  int length = 0;
-  
-  while (1) {
-    uint8_t ch;
-    HAL_StatusTypeDef status;
-    status = HAL_UART_Receive(&huart2, &ch, 1, 0xFFFF);
-    if (status == HAL_TIMEOUT) {
+  if (huart == &huart2) {
+    if ((g_ConsoleRxHead - g_ConsoleRxTail) < CONSOLE_RX_BUFFER_SIZE) {
+      g_ConsoleRxBuffer[g_ConsoleRxHead & (CONSOLE_RX_BUFFER_SIZE - 1)] = g_ConsoleRxByte;
+      g_ConsoleRxHead = g_ConsoleRxHead + 1;
+    } else {
+      g_ConsoleRxDropCount = g_ConsoleRxDropCount + 1;
+    }
+    ConsoleStartReceive();
+  }
+}
+
+extern "C" void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+  if (huart == &huart2) {
+    // オーバーランなどで HAL が受信を中断した場合は受け直す
+    if (huart->RxState == HAL_UART_STATE_READY) {
+      ConsoleStartReceive();
+    }
+    // 送信 DMA のエラーで中断された場合はその塊を諦めて続きを送る
+    if ((huart->gState == HAL_UART_STATE_READY) && (g_ConsoleTxSending != 0)) {
+      g_ConsoleTxTail = g_ConsoleTxTail + g_ConsoleTxSending;
+      g_ConsoleTxSending = 0;
+      ConsoleStartTransmit();
+    }
+  }
+}
+
+// EXTI はアプリケーション全体で 1 つのコールバックを共有するので、ここから各モジュールに振り分ける
+extern "C" void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+  // SD カードの Busy 待ち (MISO = PA6)
+  SdSpiTransport::OnExtiInterrupt(GPIO_Pin);
+}
+
+// 受信済みの文字を行バッファへ取り込み、1 行揃っていれば true を返す
+// 待たずに戻るので、入力待ちの間に他の処理を進められる
+// - CR, LF, CR+LF のいずれも行末として扱う
+// - BS/DEL で直前の 1 文字を消す
+// - 行バッファに入りきらない文字は捨てる
+extern "C" bool ConsoleIsLineAvailable(void)
+{
+  if (g_IsConsoleLineReady) {
+    return true;
+  }
+
+  while (g_ConsoleRxTail != g_ConsoleRxHead) {
+    uint8_t ch = g_ConsoleRxBuffer[g_ConsoleRxTail & (CONSOLE_RX_BUFFER_SIZE - 1)];
+    g_ConsoleRxTail = g_ConsoleRxTail + 1;
+
+    uint8_t lastChar = g_ConsoleLastChar;
+    g_ConsoleLastChar = ch;
+
+    if ((ch == '\r') || (ch == '\n')) {
+      if ((ch == '\n') && (lastChar == '\r')) {
+        continue;
+      }
+      g_ConsoleLine[g_ConsoleLineLength] = '\0';
+      g_IsConsoleLineReady = true;
+      return true;
+    }
+    if ((ch == '\b') || (ch == 0x7F)) {
+      if (g_ConsoleLineLength > 0) {
+        g_ConsoleLineLength--;
+      }
       continue;
     }
-    if (ch == '\n') {
-      buffer[length] = '\0';
-      break;
+    if (g_ConsoleLineLength < CONSOLE_LINE_SIZE - 1) {
+      g_ConsoleLine[g_ConsoleLineLength] = ch;
+      g_ConsoleLineLength++;
     }
+  }
+  return false;
+}
+
+// 揃った 1 行を取り出す (末尾の改行は除去済み、'\0' 終端)
+// bufferSize に収まらない分は切り詰める
+// 行が揃っていなければ -1 を返す
+extern "C" int ConsoleReadLine(uint8_t *pOutBuffer, int bufferSize)
+{
+  if (!ConsoleIsLineAvailable()) {
+    return -1;
+  }
 
-    buffer[length] = ch;
-    length++;
+  int length = g_ConsoleLineLength;
+  if (length > bufferSize - 1) {
+    length = bufferSize - 1;
   }
-  memcpy(pOutBuffer, buffer, length);
+  memcpy(pOutBuffer, g_ConsoleLine, length);
+  pOutBuffer[length] = '\0';
+
+  g_ConsoleLineLength = 0;
+  g_IsConsoleLineReady = false;
   return length;
 }
 /* USER CODE END 0 */
@@ -131,17 +337,47 @@ int main(void)
 
   /* Initialize all configured peripherals */
   MX_GPIO_Init();
+  MX_DMA_Init();
   MX_USART2_UART_Init();
   MX_SPI1_Init();
   /* USER CODE BEGIN 2 */
+  ConsoleStartReceive();
   printf("Hello World!\n");
   HAL_GPIO_WritePin(LD3_GPIO_Port, LD3_Pin, GPIO_PIN_SET);
 
-  SdDriver sdDriver(&hspi1);
-  sdDriver.Initialize();
+  // REPL の "transport <n>" で切り替えられる (0: Reg, 1: HAL, 2: DMA)
+  SdRegisterTransport registerTransport(&hspi1, SPI1_CS_GPIO_Port, SPI1_CS_Pin);
+  SdSpiTransport spiTransport(&hspi1, SPI1_CS_GPIO_Port, SPI1_CS_Pin);
+  SdDmaTransport dmaTransport(&hspi1, SPI1_CS_GPIO_Port, SPI1_CS_Pin);
+
+  // REPL の "exti" で Busy 待ちを MISO (PA6, EXTI6) の割り込みに切り替えられるようにする
+  registerTransport.SetBusyInterruptPin(GPIOA, GPIO_PIN_6, GPIO_AF5_SPI1);
+  spiTransport.SetBusyInterruptPin(GPIOA, GPIO_PIN_6, GPIO_AF5_SPI1);
+  dmaTransport.SetBusyInterruptPin(GPIOA, GPIO_PIN_6, GPIO_AF5_SPI1);
+  HAL_NVIC_SetPriority(EXTI9_5_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(EXTI9_5_IRQn);
+
+  // スタック (_Min_Stack_Size = 0x400) は MainLoop() 以下で使うので、キャッシュと同じく static にする
+  static SdDriver sdDriver(&registerTransport);
+  sdDriver.AddTransport(&spiTransport);
+  sdDriver.AddTransport(&dmaTransport);
+  SD::Result result = sdDriver.Initialize();
+  if (result != SD::Result::Ok) {
+    printf("[SD] Initialize: %s\n", SdDriver::GetResultName(result));
+    Error_Handler();
+  }
 
   printf("[SD] Initialize: OK\n");
 
+  // バッファ (512 バイト x セクタ数) はスタックに置けないので static にする
+  static SdWriteCache writeCache(&sdDriver);
+  static SdReadAhead readAhead(&sdDriver);
+  // CPU しか触らないので空いている CCMRAM に置く
+  SD_CCMRAM static SdSectorCache sectorCache(&sdDriver);
+  sdDriver.SetWriteCache(&writeCache);
+  sdDriver.SetReadAhead(&readAhead);
+  sdDriver.SetSectorCache(&sectorCache);
+
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -274,6 +510,28 @@ static void MX_USART2_UART_Init(void)
 
 }
 
+/**
+  * Enable DMA controller clock
+  */
+static void MX_DMA_Init(void)
+{
+
+  /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
+
+  /* DMA interrupt init */
+  /* DMA1_Channel2_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel2_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel2_IRQn);
+  /* DMA1_Channel3_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel3_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel3_IRQn);
+  /* DMA1_Channel7_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Channel7_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Channel7_IRQn);
+
+}
+
 /**
   * @brief GPIO Initialization Function
   * @param None
@@ -0,0 +1,451 @@
+#include "HostHal.hpp"
+#include "SdSpiRegister.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+// ----------------------------------------------------------------------
+//  HAL/CMSIS のホスト実装
+// ----------------------------------------------------------------------
+// 時間は仮想時間で、SPI の 1 バイト転送と HAL 呼び出しのオーバーヘッド、
+// HAL_Delay() の分だけ進む。DWT->CYCCNT と HAL_GetTick() はこの仮想時間から求める。
+// SdSpiRegister 経由のアクセスは FIFO をエミュレーションし、シフト中も CPU は先に進む。
+// DMA 転送も CPU とは並行に進み、完了時刻以降の __WFI() で完了コールバックを呼ぶ。
+// PA6 (MISO) を EXTI の立ち上がりにしている間の __WFI() は、Busy 解除か次の SysTick まで眠る。
+// SetSpiErrorInterval() で HAL の SPI 転送を一定回数ごとに失敗させられる。
+
+uint32_t SystemCoreClock = 32000000;
+
+GPIO_TypeDef HostGpioA;
+GPIO_TypeDef HostGpioB;
+DWT_Type HostDwt;
+CoreDebug_Type HostCoreDebug;
+
+namespace {
+
+constexpr uint32_t Pclk2Frequency = 32000000;
+
+SdCardSimulator *g_pCard = nullptr;
+uint64_t g_Now = 0;					// 仮想時間 [ns]
+uint32_t g_HalOverheadNs = 1500;	// HAL_SPI_xxx() 1 回あたりの CPU 時間
+uint32_t g_HalByteOverheadNs = 1000;	// HAL のポーリング転送の 1 バイトあたりの CPU 時間 (バイト間の隙間)
+
+bool g_IsCrcActive = false;
+
+// レジスタ直接操作の 1 アクセスあたりの CPU 時間 (バスアクセス 2 サイクル程度)
+constexpr uint32_t RegisterAccessNs = 60;
+
+// 送受信 FIFO (各 32bit) のエミュレーション (SdSpiRegister 経由のアクセスのみ)
+// 送信済み (DR に書き込み済み) で未読み出しのフレームを、シフト完了時刻と共に持つ。
+constexpr uint32_t FifoSize = 4;
+constexpr uint32_t FrameQueueSize = FifoSize * 2 + 1;	// 送信 FIFO + シフトレジスタ + 受信 FIFO
+
+struct Frame {
+	uint8_t data;
+	uint64_t doneAt;	// シフト完了時刻 [ns]
+};
+
+Frame g_Frames[FrameQueueSize];
+uint32_t g_FrameCount = 0;
+uint64_t g_WireFreeAt = 0;	// 最後に書き込んだフレームのシフト完了時刻
+
+// 実行中の DMA 転送 (カードとのやり取りは開始時に済ませ、完了の通知だけ遅らせる)
+SPI_HandleTypeDef *g_pDmaSpi = nullptr;
+bool g_IsDmaReceive = false;
+bool g_IsDmaError = false;
+
+// HAL_SPI_xxx() の失敗の注入 (平均 g_SpiErrorInterval 回に 1 回)
+// 一定間隔にすると、それより多く転送する処理は再試行しても毎回同じ所で失敗するので擬似乱数で決める
+uint32_t g_SpiErrorInterval = 0;
+uint32_t g_SpiErrorRandom = 0x12345678;
+
+// PA6 が EXTI の立ち上がり入力で、まだ立ち上がりを通知していない
+bool g_IsMisoEdgeArmed = false;
+bool g_IsMisoEdgeLost = false;
+
+bool IsMisoPin(GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin)
+{
+	return (GPIOx == GPIOA) && ((GPIO_Pin & GPIO_PIN_6) != 0);
+}
+
+// CR1.BR から 1 バイトの転送時間を求める
+uint64_t GetByteTimeNs(SPI_TypeDef *spi)
+{
+	uint32_t prescaler = 2U << ((spi->CR1 & SPI_CR1_BR) >> 3);
+	return 8ULL * 1000000000ULL * prescaler / Pclk2Frequency;
+}
+
+// カードとの 1 バイト交換と CRC 計算ユニットの更新 (時間は進めない)
+uint8_t ExchangeFrame(SPI_TypeDef *spi, uint8_t txData)
+{
+	uint8_t rxData = (g_pCard != nullptr) ? g_pCard->Exchange(txData, g_Now) : 0xFF;
+
+	// SPI の CRC 計算ユニット (CRCEN を立てた時点で 0 クリアされる)
+	if ((spi->CR1 & SPI_CR1_CRCEN) != 0) {
+		if (!g_IsCrcActive) {
+			spi->TXCRCR = 0;
+			spi->RXCRCR = 0;
+			g_IsCrcActive = true;
+		}
+		uint16_t polynomial = static_cast<uint16_t>(spi->CRCPR);
+		spi->TXCRCR = HostHal::UpdateCrc16(static_cast<uint16_t>(spi->TXCRCR), polynomial, txData);
+		spi->RXCRCR = HostHal::UpdateCrc16(static_cast<uint16_t>(spi->RXCRCR), polynomial, rxData);
+	} else {
+		g_IsCrcActive = false;
+	}
+	return rxData;
+}
+
+// DMA 転送中に CPU から SPI を操作するのはドライバの誤り
+void CheckDmaIdle()
+{
+	if (g_pDmaSpi != nullptr) {
+		fprintf(stderr, "[hal] SPI accessed during DMA transfer\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+uint8_t ExchangeByte(SPI_TypeDef *spi, uint8_t txData)
+{
+	CheckDmaIdle();
+	uint8_t rxData = ExchangeFrame(spi, txData);
+	HostHal::Advance(GetByteTimeNs(spi));
+	return rxData;
+}
+
+// 受信 FIFO に入っている (シフトが完了した) フレーム数
+uint32_t GetReceivedCount(SPI_TypeDef *spi)
+{
+	uint32_t count = 0;
+	while ((count < g_FrameCount) && (g_Frames[count].doneAt <= g_Now)) {
+		count++;
+	}
+	if ((count > FifoSize) && ((spi->SR & SPI_SR_OVR) == 0)) {
+		// 実機ではあふれたフレームは捨てられる
+		fprintf(stderr, "[hal] RX FIFO overrun\n");
+		spi->SR |= SPI_SR_OVR;
+	}
+	return count;
+}
+
+// 今回の HAL_SPI_xxx() を失敗させるか
+bool IsSpiErrorInjected()
+{
+	if (g_SpiErrorInterval == 0) {
+		return false;
+	}
+	// xorshift32 (毎回同じ系列になるよう種は固定)
+	g_SpiErrorRandom ^= g_SpiErrorRandom << 13;
+	g_SpiErrorRandom ^= g_SpiErrorRandom >> 17;
+	g_SpiErrorRandom ^= g_SpiErrorRandom << 5;
+	return (g_SpiErrorRandom % g_SpiErrorInterval) == 0;
+}
+
+// ポーリング転送のタイムアウト (転送せずに Timeout [ms] 待ったことにする)
+HAL_StatusTypeDef FailPolling(SPI_HandleTypeDef *hspi, uint32_t Timeout)
+{
+	HostHal::Advance(static_cast<uint64_t>(Timeout) * 1000000);
+	hspi->ErrorCode = HAL_SPI_ERROR_FLAG;
+	return HAL_TIMEOUT;
+}
+
+// DMA 転送を開始する (pRxData が nullptr なら送信のみ)
+// 仮想時間は進めず、完了時刻を g_WireFreeAt に残して __WFI() で追いつく。
+void StartDma(SPI_HandleTypeDef *hspi, const uint8_t *pTxData, bool isTxMemInc, uint8_t *pRxData, uint16_t Size)
+{
+	CheckDmaIdle();
+	HostHal::Advance(g_HalOverheadNs);
+	SET_BIT(hspi->Instance->CR1, SPI_CR1_SPE);
+
+	// カードには転送中の時刻を渡す
+	const uint64_t start = g_Now;
+	const uint64_t byteTime = GetByteTimeNs(hspi->Instance);
+	for (uint16_t i = 0; i < Size; i++) {
+		uint8_t rxData = ExchangeFrame(hspi->Instance, pTxData[isTxMemInc ? i : 0]);
+		if (pRxData != nullptr) {
+			pRxData[i] = rxData;
+		}
+		g_Now += byteTime;
+	}
+	g_WireFreeAt = g_Now;
+	g_Now = start;
+
+	g_pDmaSpi = hspi;
+	g_IsDmaReceive = (pRxData != nullptr);
+	g_IsDmaError = IsSpiErrorInjected();
+
+	// HAL_DMA_Start_IT() と同じくチャネルを有効にする (F3 の HAL は完了しても EN を落とさない)
+	SET_BIT(hspi->hdmatx->Instance->CCR, DMA_CCR_EN);
+	if (pRxData != nullptr) {
+		SET_BIT(hspi->hdmarx->Instance->CCR, DMA_CCR_EN);
+	}
+}
+
+} // namespace
+
+namespace HostHal {
+
+void AttachCard(SdCardSimulator *pCard)
+{
+	g_pCard = pCard;
+}
+
+void SetHalOverhead(uint32_t ns)
+{
+	g_HalOverheadNs = ns;
+}
+
+void SetHalByteOverhead(uint32_t ns)
+{
+	g_HalByteOverheadNs = ns;
+}
+
+uint64_t GetTimeNs()
+{
+	return g_Now;
+}
+
+void Advance(uint64_t ns)
+{
+	// CYCCNT は有効化時に 0 クリアされるので、経過サイクル数を加算する
+	const uint64_t cyclesPerUs = SystemCoreClock / 1000000;
+	uint64_t before = g_Now * cyclesPerUs / 1000;
+	g_Now += ns;
+	if ((HostDwt.CTRL & DWT_CTRL_CYCCNTENA_Msk) != 0) {
+		HostDwt.CYCCNT += static_cast<uint32_t>((g_Now * cyclesPerUs / 1000) - before);
+	}
+}
+
+void SetSpiErrorInterval(uint32_t interval)
+{
+	g_SpiErrorInterval = interval;
+}
+
+void SetMisoEdgeLost(bool isLost)
+{
+	g_IsMisoEdgeLost = isLost;
+}
+
+uint16_t UpdateCrc16(uint16_t crc, uint16_t polynomial, uint8_t data)
+{
+	crc ^= static_cast<uint16_t>(data << 8);
+	for (int bit = 0; bit < 8; bit++) {
+		crc = ((crc & 0x8000) != 0) ? static_cast<uint16_t>((crc << 1) ^ polynomial) : static_cast<uint16_t>(crc << 1);
+	}
+	return crc;
+}
+
+// SdSpiRegister のエミュレーション
+uint32_t SpiGetStatus(SPI_TypeDef *spi)
+{
+	Advance(RegisterAccessNs);
+
+	uint32_t receivedCount = GetReceivedCount(spi);
+	uint32_t status = (spi->SR & SPI_SR_OVR);
+	// 送信 FIFO が半分以下 (シフト開始前のフレームが 2 以下) なら TXE
+	const uint64_t byteTime = GetByteTimeNs(spi);
+	uint32_t waitingCount = 0;
+	for (uint32_t i = receivedCount; i < g_FrameCount; i++) {
+		if (g_Frames[i].doneAt - byteTime > g_Now) {
+			waitingCount++;
+		}
+	}
+	if (waitingCount <= FifoSize / 2) {
+		status |= SPI_SR_TXE;
+	}
+	// FRXTH = 1 なら 8bit、0 なら 16bit 受信で RXNE が立つ
+	uint32_t threshold = ((spi->CR2 & SPI_CR2_FRXTH) != 0) ? 1 : 2;
+	if (receivedCount >= threshold) {
+		status |= SPI_SR_RXNE;
+	}
+	return status;
+}
+
+void SpiWriteData(SPI_TypeDef *spi, uint16_t data, uint32_t frameCount)
+{
+	Advance(RegisterAccessNs);
+	CheckDmaIdle();
+
+	if ((spi->CR1 & SPI_CR1_SPE) == 0) {
+		fprintf(stderr, "[hal] DR written while SPE = 0\n");
+		exit(EXIT_FAILURE);
+	}
+	const uint64_t byteTime = GetByteTimeNs(spi);
+	for (uint32_t i = 0; i < frameCount; i++) {
+		if (g_FrameCount == FrameQueueSize) {
+			fprintf(stderr, "[hal] TX FIFO overflow\n");
+			exit(EXIT_FAILURE);
+		}
+		// カードとのやり取りは書き込み時点で済ませ、完了時刻だけ後ろにずらす
+		uint64_t start = (g_WireFreeAt > g_Now) ? g_WireFreeAt : g_Now;
+		g_WireFreeAt = start + byteTime;
+		g_Frames[g_FrameCount].data = ExchangeFrame(spi, static_cast<uint8_t>(data >> (8 * i)));
+		g_Frames[g_FrameCount].doneAt = g_WireFreeAt;
+		g_FrameCount++;
+	}
+}
+
+uint16_t SpiReadData(SPI_TypeDef *spi, uint32_t frameCount)
+{
+	Advance(RegisterAccessNs);
+
+	if (GetReceivedCount(spi) < frameCount) {
+		fprintf(stderr, "[hal] RX FIFO underrun\n");
+		exit(EXIT_FAILURE);
+	}
+	uint16_t data = 0;
+	for (uint32_t i = 0; i < frameCount; i++) {
+		data |= static_cast<uint16_t>(g_Frames[i].data << (8 * i));
+	}
+	for (uint32_t i = frameCount; i < g_FrameCount; i++) {
+		g_Frames[i - frameCount] = g_Frames[i];
+	}
+	g_FrameCount -= frameCount;
+	return data;
+}
+
+}
+
+extern "C" {
+
+void HAL_Delay(uint32_t Delay)
+{
+	HostHal::Advance(static_cast<uint64_t>(Delay) * 1000000);
+}
+
+uint32_t HAL_GetTick(void)
+{
+	return static_cast<uint32_t>(g_Now / 1000000);
+}
+
+uint32_t HAL_RCC_GetPCLK2Freq(void)
+{
+	return Pclk2Frequency;
+}
+
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init)
+{
+	HostHal::Advance(g_HalOverheadNs);
+	if (IsMisoPin(GPIOx, GPIO_Init->Pin)) {
+		g_IsMisoEdgeArmed = (GPIO_Init->Mode == GPIO_MODE_IT_RISING);
+	}
+}
+
+void HAL_GPIO_DeInit(GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin)
+{
+	HostHal::Advance(g_HalOverheadNs);
+	if (IsMisoPin(GPIOx, GPIO_Pin)) {
+		g_IsMisoEdgeArmed = false;
+	}
+}
+
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin)
+{
+	HostHal::Advance(RegisterAccessNs);
+	if (IsMisoPin(GPIOx, GPIO_Pin)) {
+		return ((g_pCard != nullptr) && g_pCard->IsBusy(g_Now)) ? GPIO_PIN_RESET : GPIO_PIN_SET;
+	}
+	return ((GPIOx->ODR & GPIO_Pin) != 0) ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState)
+{
+	if (PinState == GPIO_PIN_SET) {
+		GPIOx->ODR |= GPIO_Pin;
+	} else {
+		GPIOx->ODR &= ~static_cast<uint32_t>(GPIO_Pin);
+	}
+
+	if ((GPIOx == SPI1_CS_GPIO_Port) && ((GPIO_Pin & SPI1_CS_Pin) != 0) && (g_pCard != nullptr)) {
+		// CS は負論理
+		g_pCard->SetSelected(PinState == GPIO_PIN_RESET);
+	}
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout)
+{
+	HostHal::Advance(g_HalOverheadNs);
+	if (IsSpiErrorInjected()) {
+		return FailPolling(hspi, Timeout);
+	}
+	SET_BIT(hspi->Instance->CR1, SPI_CR1_SPE);
+	for (uint16_t i = 0; i < Size; i++) {
+		ExchangeByte(hspi->Instance, pData[i]);
+		HostHal::Advance(g_HalByteOverheadNs);
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout)
+{
+	HostHal::Advance(g_HalOverheadNs);
+	if (IsSpiErrorInjected()) {
+		return FailPolling(hspi, Timeout);
+	}
+	SET_BIT(hspi->Instance->CR1, SPI_CR1_SPE);
+	for (uint16_t i = 0; i < Size; i++) {
+		pRxData[i] = ExchangeByte(hspi->Instance, pTxData[i]);
+		HostHal::Advance(g_HalByteOverheadNs);
+	}
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size)
+{
+	StartDma(hspi, pData, true, nullptr, Size);
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size)
+{
+	// 送信側のメモリインクリメント (CCR.MINC) を反映する
+	const bool isTxMemInc = READ_BIT(hspi->hdmatx->Instance->CCR, DMA_CCR_MINC) != 0;
+	StartDma(hspi, pTxData, isTxMemInc, pRxData, Size);
+	return HAL_OK;
+}
+
+// 割り込みは DMA 完了と PA6 の EXTI を模擬する (発生時刻まで眠ってからコールバックを呼ぶ)
+void HostWaitForInterrupt(void)
+{
+	if ((g_pDmaSpi == nullptr) && g_IsMisoEdgeArmed) {
+		// Busy 解除 (DO の立ち上がり) までに SysTick が来ればそこで起きる
+		uint64_t nextTick = (g_Now / 1000000 + 1) * 1000000;
+		uint64_t edgeAt = ((g_pCard != nullptr) && g_pCard->IsBusy(g_Now)) ? g_pCard->GetBusyUntil() : g_Now;
+		if (g_IsMisoEdgeLost || (edgeAt >= nextTick)) {
+			HostHal::Advance(nextTick - g_Now);
+			return;
+		}
+		HostHal::Advance(edgeAt - g_Now);
+		g_IsMisoEdgeArmed = false;
+		HAL_GPIO_EXTI_Callback(GPIO_PIN_6);
+		return;
+	}
+	if (g_pDmaSpi == nullptr) {
+		return;
+	}
+	if (g_WireFreeAt > g_Now) {
+		HostHal::Advance(g_WireFreeAt - g_Now);
+	}
+	SPI_HandleTypeDef *hspi = g_pDmaSpi;
+	g_pDmaSpi = nullptr;
+	if (g_IsDmaError) {
+		hspi->ErrorCode = HAL_SPI_ERROR_DMA;
+		HAL_SPI_ErrorCallback(hspi);
+	} else if (g_IsDmaReceive) {
+		HAL_SPI_TxRxCpltCallback(hspi);
+	} else {
+		HAL_SPI_TxCpltCallback(hspi);
+	}
+}
+
+void HostNop(void)
+{
+	HostHal::Advance(1000000000ULL / SystemCoreClock);
+}
+
+void Error_Handler(void)
+{
+	fprintf(stderr, "Error_Handler\n");
+	exit(EXIT_FAILURE);
+}
+
+}
@@ -0,0 +1,30 @@
+#ifndef HOST_HAL_HPP
+#define HOST_HAL_HPP
+
+#include "main.h"
+#include "SdCardSimulator.hpp"
+
+// ホスト用 HAL の設定
+namespace HostHal {
+
+// SPI の送受信先 (CS 操作も通知する)
+void AttachCard(SdCardSimulator *pCard);
+// HAL_SPI_xxx() 1 回あたりに加算する CPU 時間
+void SetHalOverhead(uint32_t ns);
+// HAL のポーリング転送で 1 バイト毎に加算する CPU 時間 (DMA 版には加算しない)
+void SetHalByteOverhead(uint32_t ns);
+// 仮想時間 [ns]
+uint64_t GetTimeNs();
+// 仮想時間を進める (DWT->CYCCNT も更新する)
+void Advance(uint64_t ns);
+// HAL_SPI_xxx() を平均 n 回に 1 回失敗させる (0 なら失敗させない)
+// ポーリング転送は Timeout [ms] 待ってから HAL_TIMEOUT を返し、DMA 転送は完了時にエラーコールバックを呼ぶ。
+void SetSpiErrorInterval(uint32_t interval);
+// PA6 (MISO) の EXTI の立ち上がりを取りこぼす (__WFI() は SysTick でしか起きない)
+void SetMisoEdgeLost(bool isLost);
+// CRC16 を 1 バイト分更新する (SPI の CRC 計算ユニット相当)
+uint16_t UpdateCrc16(uint16_t crc, uint16_t polynomial, uint8_t data);
+
+}
+
+#endif /* HOST_HAL_HPP */
@@ -0,0 +1,280 @@
+// ----------------------------------------------------------------------
+//  ホスト (Linux) 上で SdDriver を SD カードシミュレータにつないで動かす
+// ----------------------------------------------------------------------
+// REPL のコマンドは標準入力から 1 行ずつ読み、EOF で終了する。
+//
+//   $ make
+//   $ ./sdsim --create 64 card.img
+//   $ printf 'bench seqr 0 1024\nbench rndw 4096 1024 200\n' | ./sdsim card.img
+//
+// 時間はすべて仮想時間 (SPI の転送時間 + HAL 呼び出し毎の固定オーバーヘッド +
+// カードの遅延モデル) なので、ベンチマーク結果は実行するマシンに依存しない。
+//
+// 通信路は REPL の "transport <n>" で切り替えられる。
+//   0: Sim (シミュレータ直結)  1: Reg (レジスタ直接操作のエミュレーション)
+//   2: HAL (HAL のスタブ経由)  3: DMA (同左, DMA 版 API)
+#include "HostHal.hpp"
+#include "SimulatorTransport.hpp"
+#include "SdDriver.hpp"
+#include "SdSpiTransport.hpp"
+#include "SdRegisterTransport.hpp"
+#include "SdDmaTransport.hpp"
+#include "SdWriteCache.hpp"
+#include "SdReadAhead.hpp"
+#include "SdSectorCache.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+SPI_TypeDef g_Spi1;
+DMA_Channel_TypeDef g_DmaChannel2;
+DMA_Channel_TypeDef g_DmaChannel3;
+DMA_HandleTypeDef g_DmaSpi1Rx;
+DMA_HandleTypeDef g_DmaSpi1Tx;
+SPI_HandleTypeDef g_HandleSpi1;
+
+SdCardSimulator *g_pCard = nullptr;
+
+// シミュレータ直結の通信路の呼び出し 1 回あたりの CPU 時間
+// (レジスタを直接叩く程度の実装を想定)
+constexpr uint32_t DefaultSimOverheadNs = 200;
+
+char g_Line[256];
+bool g_IsLineReady = false;
+
+void PrintUsage(const char *pProgram)
+{
+	printf("Usage: %s [options] <image>\n", pProgram);
+	printf("  --create <MiB>          Create (overwrite) the image with the given size\n");
+	printf("  --read-latency-us <n>   CMD17/CMD18 access latency    (default %lu)\n", (unsigned long)SdCardSimulator::DefaultTiming.readLatencyUs);
+	printf("  --next-block-us <n>     CMD18 inter-block latency     (default %lu)\n", (unsigned long)SdCardSimulator::DefaultTiming.nextBlockUs);
+	printf("  --write-busy-us <n>     Busy after each written block (default %lu)\n", (unsigned long)SdCardSimulator::DefaultTiming.writeBusyUs);
+	printf("  --multi-write-busy-us <n> Busy after each CMD25 block (default %lu)\n", (unsigned long)SdCardSimulator::DefaultTiming.multiWriteBusyUs);
+	printf("  --stop-busy-us <n>      Busy after CMD12/Stop Tran    (default %lu)\n", (unsigned long)SdCardSimulator::DefaultTiming.stopBusyUs);
+	printf("  --erase-busy-us <n>     Busy after CMD38              (default %lu)\n", (unsigned long)SdCardSimulator::DefaultTiming.eraseBusyUs);
+	printf("  --gc-interval <n>       Add a long busy every n writes (default 0: off)\n");
+	printf("  --gc-busy-us <n>        Length of that busy          (default %lu)\n", (unsigned long)SdCardSimulator::DefaultTiming.gcBusyUs);
+	printf("  --read-crc-error-interval <n> Corrupt the CRC of every n-th read block (default 0: off)\n");
+	printf("  --hal-overhead-ns <n>   CPU time per HAL SPI call     (default 1500)\n");
+	printf("  --hal-byte-overhead-ns <n> CPU time per byte in HAL polled transfers (default 1000)\n");
+	printf("  --spi-error-interval <n> Fail 1 in n HAL SPI calls (hal/dma transports, default 0: off)\n");
+	printf("  --lose-busy-irq         Never deliver the busy-release interrupt (exti waits until timeout)\n");
+	printf("  --sim-overhead-ns <n>   CPU time per Sim transport call (default %lu)\n", (unsigned long)DefaultSimOverheadNs);
+	printf("  --transport <name>      Initial transport: sim, reg, hal, dma (default sim)\n");
+	printf("REPL commands are read from stdin.\n");
+}
+
+void PrintStatistics()
+{
+	if (g_pCard == nullptr) {
+		return;
+	}
+	const SdCardSimulator::Statistics &statistics = g_pCard->GetStatistics();
+	printf("[sim] Virtual time %llu us, %lu commands, %lu blocks read, %lu blocks written, %lu CRC errors\n",
+		static_cast<unsigned long long>(HostHal::GetTimeNs() / 1000),
+		(unsigned long)statistics.commandCount,
+		(unsigned long)statistics.readBlockCount,
+		(unsigned long)statistics.writeBlockCount,
+		(unsigned long)statistics.crcErrorCount);
+}
+
+FILE *OpenImage(const char *pPath, uint32_t createMiB)
+{
+	if (createMiB == 0) {
+		return fopen(pPath, "r+b");
+	}
+
+	FILE *pImage = fopen(pPath, "w+b");
+	if (pImage != nullptr) {
+		static const uint8_t Zero[512] = {};
+		for (uint32_t i = 0; i < createMiB * 2048; i++) {
+			fwrite(Zero, 1, sizeof(Zero), pImage);
+		}
+		fflush(pImage);
+	}
+	return pImage;
+}
+
+} // namespace
+
+// ----------------------------------------------------------------------
+//  コンソール (main.cpp の代わり)
+// ----------------------------------------------------------------------
+extern "C" bool ConsoleIsLineAvailable(void)
+{
+	if (g_IsLineReady) {
+		return true;
+	}
+	if (fgets(g_Line, sizeof(g_Line), stdin) == nullptr) {
+		printf("\n");
+		PrintStatistics();
+		exit(EXIT_SUCCESS);
+	}
+	g_Line[strcspn(g_Line, "\r\n")] = '\0';
+	g_IsLineReady = true;
+	return true;
+}
+
+extern "C" int ConsoleReadLine(uint8_t *pOutBuffer, int bufferSize)
+{
+	if (!ConsoleIsLineAvailable()) {
+		return -1;
+	}
+	int length = static_cast<int>(strlen(g_Line));
+	if (length > bufferSize - 1) {
+		length = bufferSize - 1;
+	}
+	memcpy(pOutBuffer, g_Line, length);
+	pOutBuffer[length] = '\0';
+	g_IsLineReady = false;
+	return length;
+}
+
+extern "C" void ConsoleFlush(void)
+{
+	fflush(stdout);
+}
+
+extern "C" uint32_t ConsoleGetDropCount(void)
+{
+	return 0;
+}
+
+// 実機の main.cpp と同じく EXTI のコールバックから振り分ける
+extern "C" void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+	SdSpiTransport::OnExtiInterrupt(GPIO_Pin);
+}
+
+int main(int argc, char *argv[])
+{
+	SdCardSimulator::Timing timing = SdCardSimulator::DefaultTiming;
+	uint32_t createMiB = 0;
+	uint32_t simOverheadNs = DefaultSimOverheadNs;
+	const char *pTransportName = "sim";
+	const char *pImagePath = nullptr;
+	bool isBusyInterruptLost = false;
+
+	for (int i = 1; i < argc; i++) {
+		const char *pArg = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if (pArg[0] != '-') {
+			pImagePath = pArg;
+		} else if (hasValue && (strcmp(pArg, "--create") == 0)) {
+			createMiB = strtoul(argv[++i], nullptr, 0);
+		} else if (hasValue && (strcmp(pArg, "--read-latency-us") == 0)) {
+			timing.readLatencyUs = strtoul(argv[++i], nullptr, 0);
+		} else if (hasValue && (strcmp(pArg, "--next-block-us") == 0)) {
+			timing.nextBlockUs = strtoul(argv[++i], nullptr, 0);
+		} else if (hasValue && (strcmp(pArg, "--write-busy-us") == 0)) {
+			timing.writeBusyUs = strtoul(argv[++i], nullptr, 0);
+		} else if (hasValue && (strcmp(pArg, "--multi-write-busy-us") == 0)) {
+			timing.multiWriteBusyUs = strtoul(argv[++i], nullptr, 0);
+		} else if (hasValue && (strcmp(pArg, "--stop-busy-us") == 0)) {
+			timing.stopBusyUs = strtoul(argv[++i], nullptr, 0);
+		} else if (hasValue && (strcmp(pArg, "--erase-busy-us") == 0)) {
+			timing.eraseBusyUs = strtoul(argv[++i], nullptr, 0);
+		} else if (hasValue && (strcmp(pArg, "--gc-interval") == 0)) {
+			timing.gcInterval = strtoul(argv[++i], nullptr, 0);
+		} else if (hasValue && (strcmp(pArg, "--gc-busy-us") == 0)) {
+			timing.gcBusyUs = strtoul(argv[++i], nullptr, 0);
+		} else if (hasValue && (strcmp(pArg, "--read-crc-error-interval") == 0)) {
+			timing.readCrcErrorInterval = strtoul(argv[++i], nullptr, 0);
+		} else if (hasValue && (strcmp(pArg, "--hal-overhead-ns") == 0)) {
+			HostHal::SetHalOverhead(strtoul(argv[++i], nullptr, 0));
+		} else if (hasValue && (strcmp(pArg, "--hal-byte-overhead-ns") == 0)) {
+			HostHal::SetHalByteOverhead(strtoul(argv[++i], nullptr, 0));
+		} else if (hasValue && (strcmp(pArg, "--spi-error-interval") == 0)) {
+			HostHal::SetSpiErrorInterval(strtoul(argv[++i], nullptr, 0));
+		} else if (strcmp(pArg, "--lose-busy-irq") == 0) {
+			isBusyInterruptLost = true;
+		} else if (hasValue && (strcmp(pArg, "--sim-overhead-ns") == 0)) {
+			simOverheadNs = strtoul(argv[++i], nullptr, 0);
+		} else if (hasValue && (strcmp(pArg, "--transport") == 0)) {
+			pTransportName = argv[++i];
+		} else {
+			PrintUsage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (pImagePath == nullptr) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	FILE *pImage = OpenImage(pImagePath, createMiB);
+	if (pImage == nullptr) {
+		perror(pImagePath);
+		return EXIT_FAILURE;
+	}
+	fseek(pImage, 0, SEEK_END);
+	long imageSize = ftell(pImage);
+	// CSD v2 の容量は 512KiB 単位
+	if ((imageSize < 1024 * 1024) || ((imageSize % (512 * 1024)) != 0)) {
+		fprintf(stderr, "%s: image size must be a multiple of 512 KiB and at least 1 MiB\n", pImagePath);
+		return EXIT_FAILURE;
+	}
+
+	SdCardSimulator card(pImage, static_cast<uint32_t>(imageSize / 512), timing);
+	g_pCard = &card;
+	HostHal::AttachCard(&card);
+
+	g_Spi1.CR1 = SPI_BAUDRATEPRESCALER_2;
+	g_HandleSpi1.Instance = &g_Spi1;
+	g_HandleSpi1.hdmarx = &g_DmaSpi1Rx;
+	g_HandleSpi1.hdmatx = &g_DmaSpi1Tx;
+	// CubeMX の設定 (HAL_SPI_MspInit) と同じく送受信ともメモリインクリメントを有効にしておく
+	g_DmaChannel2.CCR = DMA_CCR_MINC;
+	g_DmaChannel3.CCR = DMA_CCR_MINC;
+	g_DmaSpi1Rx.Instance = &g_DmaChannel2;
+	g_DmaSpi1Tx.Instance = &g_DmaChannel3;
+
+	// 実機の main() と同じ流れ
+	HAL_GPIO_WritePin(SPI1_CS_GPIO_Port, SPI1_CS_Pin, GPIO_PIN_SET);
+
+	SimulatorTransport simTransport(&card, simOverheadNs);
+	simTransport.SetBusyInterruptLost(isBusyInterruptLost);
+	HostHal::SetMisoEdgeLost(isBusyInterruptLost);
+	SdRegisterTransport registerTransport(&g_HandleSpi1, SPI1_CS_GPIO_Port, SPI1_CS_Pin);
+	SdSpiTransport spiTransport(&g_HandleSpi1, SPI1_CS_GPIO_Port, SPI1_CS_Pin);
+	SdDmaTransport dmaTransport(&g_HandleSpi1, SPI1_CS_GPIO_Port, SPI1_CS_Pin);
+	registerTransport.SetBusyInterruptPin(GPIOA, GPIO_PIN_6, GPIO_AF5_SPI1);
+	spiTransport.SetBusyInterruptPin(GPIOA, GPIO_PIN_6, GPIO_AF5_SPI1);
+	dmaTransport.SetBusyInterruptPin(GPIOA, GPIO_PIN_6, GPIO_AF5_SPI1);
+
+	SdDriver sdDriver(&simTransport);
+	sdDriver.AddTransport(&registerTransport);
+	sdDriver.AddTransport(&spiTransport);
+	sdDriver.AddTransport(&dmaTransport);
+	if (strcmp(pTransportName, "reg") == 0) {
+		sdDriver.SetTransport(&registerTransport);
+	} else if (strcmp(pTransportName, "hal") == 0) {
+		sdDriver.SetTransport(&spiTransport);
+	} else if (strcmp(pTransportName, "dma") == 0) {
+		sdDriver.SetTransport(&dmaTransport);
+	} else if (strcmp(pTransportName, "sim") != 0) {
+		PrintUsage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	SD::Result result = sdDriver.Initialize();
+	if (result != SD::Result::Ok) {
+		printf("[SD] Initialize: %s\n", SdDriver::GetResultName(result));
+		PrintStatistics();
+		return EXIT_FAILURE;
+	}
+
+	printf("[SD] Initialize: OK\n");
+
+	SdWriteCache writeCache(&sdDriver);
+	SdReadAhead readAhead(&sdDriver);
+	SdSectorCache sectorCache(&sdDriver);
+	sdDriver.SetWriteCache(&writeCache);
+	sdDriver.SetReadAhead(&readAhead);
+	sdDriver.SetSectorCache(&sectorCache);
+
+	sdDriver.MainLoop();
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,53 @@
+#ifndef SD_SPI_REGISTER_HPP
+#define SD_SPI_REGISTER_HPP
+
+#include "main.h"
+
+// ----------------------------------------------------------------------
+//  SPI のデータ/ステータスレジスタアクセス (ホスト用)
+// ----------------------------------------------------------------------
+// Core/Inc/SdSpiRegister.hpp の代わりにインクルードされる。
+// DR/SR へのアクセスを HostHal の SPI エミュレーション (受信 FIFO 付き) に渡す。
+namespace HostHal {
+
+uint32_t SpiGetStatus(SPI_TypeDef *spi);
+void SpiWriteData(SPI_TypeDef *spi, uint16_t data, uint32_t frameCount);
+uint16_t SpiReadData(SPI_TypeDef *spi, uint32_t frameCount);
+
+}
+
+namespace SdSpiRegister {
+
+static inline bool IsTxEmpty(SPI_TypeDef *spi)
+{
+	return (HostHal::SpiGetStatus(spi) & SPI_SR_TXE) != 0;
+}
+
+static inline bool IsRxNotEmpty(SPI_TypeDef *spi)
+{
+	return (HostHal::SpiGetStatus(spi) & SPI_SR_RXNE) != 0;
+}
+
+static inline void WriteData8(SPI_TypeDef *spi, uint8_t data)
+{
+	HostHal::SpiWriteData(spi, data, 1);
+}
+
+static inline void WriteData16(SPI_TypeDef *spi, uint16_t data)
+{
+	HostHal::SpiWriteData(spi, data, 2);
+}
+
+static inline uint8_t ReadData8(SPI_TypeDef *spi)
+{
+	return static_cast<uint8_t>(HostHal::SpiReadData(spi, 1));
+}
+
+static inline uint16_t ReadData16(SPI_TypeDef *spi)
+{
+	return HostHal::SpiReadData(spi, 2);
+}
+
+}
+
+#endif /* SD_SPI_REGISTER_HPP */
@@ -0,0 +1,207 @@
+/*
+ * ホスト (Linux) ビルド用の main.h
+ *
+ * Core/Inc/main.h の代わりにインクルードされ、SdDriver が使用する範囲の
+ * HAL/CMSIS の型・マクロ・関数だけを用意する。
+ * 関数の実体は HostHal.cpp にあり、SPI の送受信は SdCardSimulator に渡される。
+ */
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* HAL ----------------------------------------------------------------------*/
+typedef enum
+{
+  HAL_OK       = 0x00U,
+  HAL_ERROR    = 0x01U,
+  HAL_BUSY     = 0x02U,
+  HAL_TIMEOUT  = 0x03U
+} HAL_StatusTypeDef;
+
+#define SET_BIT(REG, BIT)     ((REG) |= (BIT))
+#define CLEAR_BIT(REG, BIT)   ((REG) &= ~(BIT))
+#define READ_BIT(REG, BIT)    ((REG) & (BIT))
+#define WRITE_REG(REG, VAL)   ((REG) = (VAL))
+#define READ_REG(REG)         ((REG))
+#define MODIFY_REG(REG, CLEARMASK, SETMASK)  WRITE_REG((REG), (((READ_REG(REG)) & (~(CLEARMASK))) | (SETMASK)))
+
+void HAL_Delay(uint32_t Delay);
+uint32_t HAL_GetTick(void);
+uint32_t HAL_RCC_GetPCLK2Freq(void);
+
+extern uint32_t SystemCoreClock;
+
+/* GPIO ---------------------------------------------------------------------*/
+typedef struct
+{
+  uint32_t ODR;
+} GPIO_TypeDef;
+
+typedef enum
+{
+  GPIO_PIN_RESET = 0U,
+  GPIO_PIN_SET
+} GPIO_PinState;
+
+typedef struct
+{
+  uint32_t Pin;
+  uint32_t Mode;
+  uint32_t Pull;
+  uint32_t Speed;
+  uint32_t Alternate;
+} GPIO_InitTypeDef;
+
+#define GPIO_PIN_3  ((uint16_t)0x0008)
+#define GPIO_PIN_4  ((uint16_t)0x0010)
+#define GPIO_PIN_6  ((uint16_t)0x0040)
+
+#define GPIO_MODE_AF_PP        (0x00000002U)
+#define GPIO_MODE_IT_RISING    (0x10110000U)
+#define GPIO_NOPULL            (0x00000000U)
+#define GPIO_SPEED_FREQ_HIGH   (0x00000003U)
+#define GPIO_AF5_SPI1          ((uint8_t)0x05U)
+
+extern GPIO_TypeDef HostGpioA;
+extern GPIO_TypeDef HostGpioB;
+#define GPIOA (&HostGpioA)
+#define GPIOB (&HostGpioB)
+
+// PA6 (SPI1_MISO) はカードの DO ラインの状態を返し、EXTI の立ち上がりは __WFI() で通知する
+void HAL_GPIO_Init(GPIO_TypeDef *GPIOx, GPIO_InitTypeDef *GPIO_Init);
+void HAL_GPIO_DeInit(GPIO_TypeDef *GPIOx, uint32_t GPIO_Pin);
+GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin);
+void HAL_GPIO_WritePin(GPIO_TypeDef *GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState);
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin);
+
+#define __HAL_GPIO_EXTI_CLEAR_IT(__EXTI_LINE__)  ((void)(__EXTI_LINE__))
+
+#define LD3_Pin GPIO_PIN_3
+#define LD3_GPIO_Port GPIOB
+#define SPI1_CS_Pin GPIO_PIN_4
+#define SPI1_CS_GPIO_Port GPIOB
+
+/* DMA ----------------------------------------------------------------------*/
+typedef struct
+{
+  volatile uint32_t CCR;
+} DMA_Channel_TypeDef;
+
+typedef struct
+{
+  DMA_Channel_TypeDef *Instance;
+  uint32_t State;
+} DMA_HandleTypeDef;
+
+#define DMA_CCR_EN     (0x1UL << 0U)
+#define DMA_CCR_MINC   (0x1UL << 7U)
+
+#define __HAL_DMA_DISABLE(__HANDLE__)  ((__HANDLE__)->Instance->CCR &= ~DMA_CCR_EN)
+
+/* SPI ----------------------------------------------------------------------*/
+typedef struct
+{
+  volatile uint32_t CR1;
+  volatile uint32_t CR2;
+  volatile uint32_t SR;
+  volatile uint32_t DR;
+  volatile uint32_t CRCPR;
+  volatile uint32_t RXCRCR;
+  volatile uint32_t TXCRCR;
+} SPI_TypeDef;
+
+typedef struct
+{
+  uint32_t BaudRatePrescaler;
+} SPI_InitTypeDef;
+
+typedef struct __SPI_HandleTypeDef
+{
+  SPI_TypeDef *Instance;
+  SPI_InitTypeDef Init;
+  DMA_HandleTypeDef *hdmatx;
+  DMA_HandleTypeDef *hdmarx;
+  volatile uint32_t ErrorCode;
+} SPI_HandleTypeDef;
+
+#define SPI_CR1_SPE    (0x1UL << 6U)
+#define SPI_CR1_BR     (0x7UL << 3U)
+#define SPI_CR1_CRCL   (0x1UL << 11U)
+#define SPI_CR1_CRCEN  (0x1UL << 13U)
+#define SPI_CR2_FRXTH  (0x1UL << 12U)
+#define SPI_SR_RXNE    (0x1UL << 0U)
+#define SPI_SR_TXE     (0x1UL << 1U)
+#define SPI_SR_OVR     (0x1UL << 6U)
+
+#define SPI_BAUDRATEPRESCALER_2    (0x00000000U)
+#define SPI_BAUDRATEPRESCALER_4    (0x00000008U)
+#define SPI_BAUDRATEPRESCALER_8    (0x00000010U)
+#define SPI_BAUDRATEPRESCALER_16   (0x00000018U)
+#define SPI_BAUDRATEPRESCALER_32   (0x00000020U)
+#define SPI_BAUDRATEPRESCALER_64   (0x00000028U)
+#define SPI_BAUDRATEPRESCALER_128  (0x00000030U)
+#define SPI_BAUDRATEPRESCALER_256  (0x00000038U)
+
+#define HAL_SPI_ERROR_NONE  (0x00000000U)
+#define HAL_SPI_ERROR_DMA   (0x00000010U)
+#define HAL_SPI_ERROR_FLAG  (0x00000020U)
+
+#define __HAL_SPI_DISABLE(__HANDLE__)  CLEAR_BIT((__HANDLE__)->Instance->CR1, SPI_CR1_SPE)
+
+HAL_StatusTypeDef HAL_SPI_Transmit(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout);
+HAL_StatusTypeDef HAL_SPI_Transmit_DMA(SPI_HandleTypeDef *hspi, uint8_t *pData, uint16_t Size);
+HAL_StatusTypeDef HAL_SPI_TransmitReceive_DMA(SPI_HandleTypeDef *hspi, uint8_t *pTxData, uint8_t *pRxData, uint16_t Size);
+
+void HAL_SPI_TxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi);
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi);
+
+/* Cortex-M4 ----------------------------------------------------------------*/
+typedef struct
+{
+  volatile uint32_t CTRL;
+  volatile uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct
+{
+  volatile uint32_t DEMCR;
+} CoreDebug_Type;
+
+extern DWT_Type HostDwt;
+extern CoreDebug_Type HostCoreDebug;
+#define DWT        (&HostDwt)
+#define CoreDebug  (&HostCoreDebug)
+
+#define DWT_CTRL_CYCCNTENA_Msk       (0x1UL)
+#define CoreDebug_DEMCR_TRCENA_Msk   (0x1UL << 24U)
+
+// メモリマップ (ホストのアドレスと重なることはない)
+#define CCMDATARAM_BASE  0x10000000UL
+
+// 割り込みは DMA 完了と PA6 の EXTI のみ (__WFI() で発生時刻まで仮想時間を進めて通知する)
+void HostWaitForInterrupt(void);
+// 1 サイクル分だけ仮想時間を進める (CPU の処理時間を模擬するビジーループ用)
+void HostNop(void);
+static inline void __NOP(void) { HostNop(); }
+static inline void __disable_irq(void) {}
+static inline void __enable_irq(void) {}
+static inline void __WFI(void) { HostWaitForInterrupt(); }
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t priMask) { (void)priMask; }
+static inline uint8_t __CLZ(uint32_t value) { return (value == 0) ? 32 : (uint8_t)__builtin_clz(value); }
+
+void Error_Handler(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __MAIN_H */
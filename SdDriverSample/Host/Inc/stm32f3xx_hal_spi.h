@@ -0,0 +1,10 @@
+/*
+ * ホスト (Linux) ビルド用のダミー
+ * SPI 関連の定義はすべて main.h にある
+ */
+#ifndef STM32F3xx_HAL_SPI_H
+#define STM32F3xx_HAL_SPI_H
+
+#include "main.h"
+
+#endif /* STM32F3xx_HAL_SPI_H */
@@ -0,0 +1,589 @@
+#include "SdCardSimulator.hpp"
+#include <cstring>
+
+// ----------------------------------------------------------------------
+//  static private functions
+// ----------------------------------------------------------------------
+namespace {
+
+// R1 のビット
+constexpr uint8_t R1_IN_IDLE_STATE      = 0x01;
+constexpr uint8_t R1_ERASE_SEQ_ERROR    = 0x10;
+constexpr uint8_t R1_ILLEGAL_COMMAND    = 0x04;
+constexpr uint8_t R1_COM_CRC_ERROR      = 0x08;
+constexpr uint8_t R1_PARAMETER_ERROR    = 0x40;
+
+// データレスポンス
+constexpr uint8_t DATA_ACCEPTED         = 0x05;
+constexpr uint8_t DATA_CRC_ERROR        = 0x0B;
+constexpr uint8_t DATA_WRITE_ERROR      = 0x0D;
+
+// データエラートークン (Out of Range)
+constexpr uint8_t ERROR_TOKEN_OUT_OF_RANGE = 0x08;
+
+constexpr uint64_t NsPerUs = 1000;
+
+/**
+ * ビッグエンディアンのレジスタイメージにビットフィールドを書き込む
+ * @param pRegister レジスタ (pRegister[0] の bit7 が最上位ビット)
+ * @param size レジスタのバイト数
+ * @param msb 書き込むフィールドの最上位ビット番号
+ * @param lsb 書き込むフィールドの最下位ビット番号
+ */
+void SetBits(uint8_t *pRegister, uint32_t size, uint32_t msb, uint32_t lsb, uint32_t value)
+{
+	for (uint32_t bit = lsb; bit <= msb; bit++) {
+		uint32_t byteIndex = size - 1 - (bit / 8);
+		uint8_t mask = static_cast<uint8_t>(1 << (bit % 8));
+		if ((value >> (bit - lsb)) & 1) {
+			pRegister[byteIndex] |= mask;
+		} else {
+			pRegister[byteIndex] &= ~mask;
+		}
+	}
+}
+
+// 最終バイト [7:1] に CRC7, [0] に終端ビットを付ける
+void SetRegisterCrc(uint8_t *pRegister, uint32_t size)
+{
+	pRegister[size - 1] = static_cast<uint8_t>((SdCardSimulator::GetCrc7(pRegister, size - 1) << 1) | 0x01);
+}
+
+} // namespace
+
+const SdCardSimulator::Timing SdCardSimulator::DefaultTiming = {
+	/* readLatencyUs */ 300,
+	/* nextBlockUs   */ 20,
+	/* writeBusyUs   */ 800,
+	/* multiWriteBusyUs */ 150,
+	/* stopBusyUs    */ 100,
+	/* eraseBusyUs   */ 5000,
+	/* gcInterval    */ 0,
+	/* gcBusyUs      */ 50000,
+	/* initRetries   */ 3,
+	/* readCrcErrorInterval */ 0,
+};
+
+SdCardSimulator::SdCardSimulator(FILE *pImage, uint32_t sectorCount, const Timing &timing)
+	: m_pImage(pImage)
+	, m_SectorCount(sectorCount)
+	, m_Timing(timing)
+	, m_Statistics()
+	, m_IsSelected(false)
+	, m_IsIdle(true)
+	, m_IsAppCommand(false)
+	, m_IsCrcEnabled(false)
+	, m_InitCount(0)
+	, m_State(State::Ready)
+	, m_CommandLength(0)
+	, m_BusyUntil(0)
+	, m_PacketLength(0)
+	, m_PacketPosition(0)
+	, m_IsPacketLoaded(false)
+	, m_PacketReadyAt(0)
+	, m_Sector(0)
+	, m_EraseStart(0xFFFFFFFF)
+	, m_EraseEnd(0xFFFFFFFF)
+	, m_WriteCount(0)
+	, m_IsMultipleWrite(false)
+{
+}
+
+void SdCardSimulator::SetSelected(bool isSelected)
+{
+	m_IsSelected = isSelected;
+}
+
+uint8_t SdCardSimulator::Exchange(uint8_t mosi, uint64_t now)
+{
+	// 非選択中は DO がハイインピーダンス (プルアップで 0xFF) になり、入力も無視する
+	if (!m_IsSelected) {
+		return 0xFF;
+	}
+
+	// 全二重なので、出力は今回の入力を処理する前の状態で決まる
+	uint8_t miso = GetOutput(now);
+	ProcessInput(mosi, now);
+	return miso;
+}
+
+bool SdCardSimulator::IsBusy(uint64_t now) const
+{
+	return m_IsSelected && (now < m_BusyUntil);
+}
+
+uint64_t SdCardSimulator::GetBusyUntil() const
+{
+	return m_BusyUntil;
+}
+
+const SdCardSimulator::Statistics &SdCardSimulator::GetStatistics() const
+{
+	return m_Statistics;
+}
+
+uint8_t SdCardSimulator::GetCrc7(const uint8_t *pData, uint32_t size)
+{
+	// x^7 + x^3 + 1 (ドライバのテーブル版とは独立にビット単位で計算する)
+	uint8_t crc = 0;
+	for (uint32_t i = 0; i < size; i++) {
+		uint8_t data = pData[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc <<= 1;
+			if (((data ^ crc) & 0x80) != 0) {
+				crc ^= 0x09;
+			}
+			data <<= 1;
+		}
+	}
+	return crc & 0x7F;
+}
+
+uint16_t SdCardSimulator::GetCrc16(const uint8_t *pData, uint32_t size)
+{
+	// x^16 + x^12 + x^5 + 1
+	uint16_t crc = 0;
+	for (uint32_t i = 0; i < size; i++) {
+		crc ^= static_cast<uint16_t>(pData[i] << 8);
+		for (int bit = 0; bit < 8; bit++) {
+			crc = ((crc & 0x8000) != 0) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+		}
+	}
+	return crc;
+}
+
+uint8_t SdCardSimulator::GetOutput(uint64_t now)
+{
+	if (!m_Response.empty()) {
+		uint8_t data = m_Response.front();
+		m_Response.pop_front();
+		return data;
+	}
+
+	// Busy の間は DO が Lo 固定
+	if (now < m_BusyUntil) {
+		return 0x00;
+	}
+
+	if ((m_State != State::ReadSingle) && (m_State != State::ReadMultiple)) {
+		return 0xFF;
+	}
+	if (!m_IsPacketLoaded || (now < m_PacketReadyAt)) {
+		return 0xFF;
+	}
+
+	uint8_t data = m_Packet[m_PacketPosition];
+	m_PacketPosition++;
+	if (m_PacketPosition == m_PacketLength) {
+		m_IsPacketLoaded = false;
+		if (m_State == State::ReadMultiple) {
+			// 次のブロックを用意する
+			m_Sector++;
+			if (LoadSector(m_Sector)) {
+				m_PacketReadyAt = now + m_Timing.nextBlockUs * NsPerUs;
+			} else {
+				m_Packet[0] = ERROR_TOKEN_OUT_OF_RANGE;
+				m_PacketLength = 1;
+				m_PacketPosition = 0;
+				m_IsPacketLoaded = true;
+				m_PacketReadyAt = now;
+				m_State = State::ReadSingle;
+			}
+		} else {
+			m_State = State::Ready;
+		}
+	}
+	return data;
+}
+
+void SdCardSimulator::ProcessInput(uint8_t mosi, uint64_t now)
+{
+	if (m_State == State::WriteData) {
+		ReceiveWriteData(mosi, now);
+		return;
+	}
+
+	// 書き込み待ちの間はデータ開始トークン/Stop Tran トークンを受け付ける
+	if (((m_State == State::WriteSingle) || (m_State == State::WriteMultiple)) && (m_CommandLength == 0)) {
+		if (now < m_BusyUntil) {
+			return;
+		}
+		uint8_t startToken = (m_State == State::WriteSingle) ? 0xFE : 0xFC;
+		if (mosi == startToken) {
+			m_State = State::WriteData;
+			m_PacketPosition = 0;
+			return;
+		}
+		if ((m_State == State::WriteMultiple) && (mosi == 0xFD)) {
+			// Stop Tran トークンの 1 バイト後から Busy になる
+			// 実際のカードと同じく、溜めたブロックの書き込みはここでまとめて行う
+			m_Response.push_back(0xFF);
+			m_BusyUntil = now + (m_Timing.stopBusyUs + m_Timing.writeBusyUs) * NsPerUs;
+			m_State = State::Ready;
+			return;
+		}
+	}
+
+	// コマンドは 01xxxxxx で始まる
+	if ((m_CommandLength == 0) && ((mosi & 0xC0) != 0x40)) {
+		return;
+	}
+	m_Command[m_CommandLength] = mosi;
+	m_CommandLength++;
+	if (m_CommandLength == sizeof(m_Command)) {
+		ExecuteCommand(now);
+		m_CommandLength = 0;
+	}
+}
+
+void SdCardSimulator::ExecuteCommand(uint64_t now)
+{
+	m_Statistics.commandCount++;
+
+	uint8_t command = m_Command[0] & 0x3F;
+	uint32_t argument = ((static_cast<uint32_t>(m_Command[1]) << 24) |
+						 (static_cast<uint32_t>(m_Command[2]) << 16) |
+						 (static_cast<uint32_t>(m_Command[3]) <<  8) |
+						 (static_cast<uint32_t>(m_Command[4]) <<  0));
+	bool isAppCommand = m_IsAppCommand;
+	m_IsAppCommand = false;
+
+	// NCR (最低 1 バイト)
+	m_Response.push_back(0xFF);
+
+	// CMD0/CMD8 は CRC 無効時でも CRC を確認する
+	if (m_IsCrcEnabled || (command == 0) || (command == 8)) {
+		uint8_t crc = static_cast<uint8_t>((GetCrc7(m_Command, 5) << 1) | 0x01);
+		if (crc != m_Command[5]) {
+			m_Statistics.crcErrorCount++;
+			PushResponse(GetR1() | R1_COM_CRC_ERROR);
+			return;
+		}
+	}
+
+	// 初期化完了前に受け付けるコマンド
+	if (m_IsIdle) {
+		bool isAllowed = (command == 0) || (command == 8) || (command == 55) || (command == 58) || (command == 59) ||
+						 (isAppCommand && (command == 41));
+		if (!isAllowed) {
+			PushResponse(GetR1() | R1_ILLEGAL_COMMAND);
+			return;
+		}
+	}
+
+	uint8_t registerData[64];
+
+	switch (command) {
+	case 0:		// GO_IDLE_STATE
+		m_IsIdle = true;
+		m_IsCrcEnabled = false;
+		m_InitCount = 0;
+		m_State = State::Ready;
+		m_IsPacketLoaded = false;
+		m_BusyUntil = 0;
+		PushResponse(GetR1());
+		break;
+
+	case 8:		// SEND_IF_COND (R7)
+		PushResponse(GetR1());
+		PushResponse(0x00);
+		PushResponse(0x00);
+		PushResponse(static_cast<uint8_t>((argument >> 8) & 0x0F));
+		PushResponse(static_cast<uint8_t>(argument & 0xFF));
+		break;
+
+	case 9:		// SEND_CSD
+		PushResponse(GetR1());
+		BuildCsd(registerData);
+		PrepareRegister(registerData, 16, now);
+		break;
+
+	case 10:	// SEND_CID
+		PushResponse(GetR1());
+		BuildCid(registerData);
+		PrepareRegister(registerData, 16, now);
+		break;
+
+	case 12:	// STOP_TRANSMISSION (R1b)
+		if (m_State == State::ReadMultiple) {
+			m_State = State::Ready;
+			m_IsPacketLoaded = false;
+		}
+		// R1 の前に 1 バイトのスタッフバイトが入る
+		PushResponse(0xFF);
+		PushResponse(GetR1());
+		m_BusyUntil = now + m_Timing.stopBusyUs * NsPerUs;
+		break;
+
+	case 13:
+		// SEND_STATUS (R2) / ACMD13 SD_STATUS (R2 + データ)
+		PushResponse(GetR1());
+		PushResponse(0x00);
+		if (isAppCommand) {
+			BuildSsr(registerData);
+			PrepareRegister(registerData, 64, now);
+		}
+		break;
+
+	case 16:	// SET_BLOCKLEN (SDHC/SDXC は 512 固定)
+		PushResponse(GetR1() | ((argument != SectorSize) ? R1_PARAMETER_ERROR : 0));
+		break;
+
+	case 17:	// READ_SINGLE_BLOCK
+	case 18:	// READ_MULTIPLE_BLOCK
+		if (argument >= m_SectorCount) {
+			PushResponse(GetR1() | R1_PARAMETER_ERROR);
+			break;
+		}
+		PushResponse(GetR1());
+		m_Sector = argument;
+		LoadSector(m_Sector);
+		m_PacketReadyAt = now + m_Timing.readLatencyUs * NsPerUs;
+		m_State = (command == 17) ? State::ReadSingle : State::ReadMultiple;
+		break;
+
+	case 24:	// WRITE_BLOCK
+	case 25:	// WRITE_MULTIPLE_BLOCK
+		if (argument >= m_SectorCount) {
+			PushResponse(GetR1() | R1_PARAMETER_ERROR);
+			break;
+		}
+		PushResponse(GetR1());
+		m_Sector = argument;
+		m_IsMultipleWrite = (command == 25);
+		m_State = (command == 24) ? State::WriteSingle : State::WriteMultiple;
+		break;
+
+	case 32:	// ERASE_WR_BLK_START
+	case 33:	// ERASE_WR_BLK_END
+		if (argument >= m_SectorCount) {
+			PushResponse(GetR1() | R1_PARAMETER_ERROR);
+			break;
+		}
+		if (command == 32) {
+			m_EraseStart = argument;
+		} else {
+			m_EraseEnd = argument;
+		}
+		PushResponse(GetR1());
+		break;
+
+	case 38:	// ERASE (R1b)
+		// R1 の前に 1 バイトのスタッフバイトが入る (CMD12 と同じ扱い)
+		PushResponse(0xFF);
+		if ((m_EraseStart >= m_SectorCount) || (m_EraseEnd >= m_SectorCount) || (m_EraseStart > m_EraseEnd)) {
+			PushResponse(GetR1() | R1_ERASE_SEQ_ERROR);
+			break;
+		}
+		PushResponse(GetR1());
+		EraseSectors(m_EraseStart, m_EraseEnd);
+		m_EraseStart = 0xFFFFFFFF;
+		m_EraseEnd = 0xFFFFFFFF;
+		m_BusyUntil = now + m_Timing.eraseBusyUs * NsPerUs;
+		break;
+
+	case 41:	// ACMD41 SD_SEND_OP_COND
+		if (!isAppCommand) {
+			PushResponse(GetR1() | R1_ILLEGAL_COMMAND);
+			break;
+		}
+		m_InitCount++;
+		if (m_InitCount >= m_Timing.initRetries) {
+			m_IsIdle = false;
+		}
+		PushResponse(GetR1());
+		break;
+
+	case 51:	// ACMD51 SEND_SCR
+		if (!isAppCommand) {
+			PushResponse(GetR1() | R1_ILLEGAL_COMMAND);
+			break;
+		}
+		PushResponse(GetR1());
+		BuildScr(registerData);
+		PrepareRegister(registerData, 8, now);
+		break;
+
+	case 55:	// APP_CMD
+		m_IsAppCommand = true;
+		PushResponse(GetR1());
+		break;
+
+	case 58:	// READ_OCR (R3)
+	{
+		// 3.2-3.4V 対応, 初期化完了後は Busy 解除 (bit31) と CCS (bit30) を立てる
+		uint32_t ocr = 0x00FF8000;
+		if (!m_IsIdle) {
+			ocr |= 0xC0000000;
+		}
+		PushResponse(GetR1());
+		PushResponse(static_cast<uint8_t>(ocr >> 24));
+		PushResponse(static_cast<uint8_t>(ocr >> 16));
+		PushResponse(static_cast<uint8_t>(ocr >>  8));
+		PushResponse(static_cast<uint8_t>(ocr >>  0));
+		break;
+	}
+
+	case 59:	// CRC_ON_OFF
+		m_IsCrcEnabled = ((argument & 0x01) != 0);
+		PushResponse(GetR1());
+		break;
+
+	default:
+		PushResponse(GetR1() | R1_ILLEGAL_COMMAND);
+		break;
+	}
+}
+
+void SdCardSimulator::ReceiveWriteData(uint8_t mosi, uint64_t now)
+{
+	// [データ (512)][CRC (2)]
+	m_Packet[m_PacketPosition] = mosi;
+	m_PacketPosition++;
+	if (m_PacketPosition < SectorSize + 2) {
+		return;
+	}
+
+	uint8_t response = DATA_ACCEPTED;
+	if (m_IsCrcEnabled) {
+		uint16_t receivedCrc = static_cast<uint16_t>((m_Packet[SectorSize] << 8) | m_Packet[SectorSize + 1]);
+		if (receivedCrc != GetCrc16(m_Packet, SectorSize)) {
+			m_Statistics.crcErrorCount++;
+			response = DATA_CRC_ERROR;
+		}
+	}
+	if (response == DATA_ACCEPTED) {
+		if (m_Sector >= m_SectorCount) {
+			response = DATA_WRITE_ERROR;
+		} else {
+			fseek(m_pImage, static_cast<long>(m_Sector) * SectorSize, SEEK_SET);
+			fwrite(m_Packet, 1, SectorSize, m_pImage);
+			m_Statistics.writeBlockCount++;
+		}
+	}
+
+	// データレスポンスの後に Busy
+	PushResponse(response);
+	uint64_t busyUs = m_IsMultipleWrite ? m_Timing.multiWriteBusyUs : m_Timing.writeBusyUs;
+	m_WriteCount++;
+	if ((m_Timing.gcInterval != 0) && ((m_WriteCount % m_Timing.gcInterval) == 0)) {
+		busyUs += m_Timing.gcBusyUs;
+	}
+	m_BusyUntil = now + busyUs * NsPerUs;
+
+	if (m_IsMultipleWrite) {
+		m_Sector++;
+		m_State = State::WriteMultiple;
+	} else {
+		m_State = State::Ready;
+	}
+}
+
+uint8_t SdCardSimulator::GetR1() const
+{
+	return m_IsIdle ? R1_IN_IDLE_STATE : 0x00;
+}
+
+void SdCardSimulator::PushResponse(uint8_t data)
+{
+	m_Response.push_back(data);
+}
+
+void SdCardSimulator::PrepareRegister(const uint8_t *pData, uint32_t size, uint64_t now)
+{
+	LoadPacket(pData, size);
+	m_PacketReadyAt = now;
+	m_State = State::ReadSingle;
+}
+
+bool SdCardSimulator::LoadSector(uint32_t sector)
+{
+	if (sector >= m_SectorCount) {
+		return false;
+	}
+	uint8_t data[SectorSize];
+	fseek(m_pImage, static_cast<long>(sector) * SectorSize, SEEK_SET);
+	if (fread(data, 1, SectorSize, m_pImage) != SectorSize) {
+		memset(data, 0, sizeof(data));
+	}
+	LoadPacket(data, SectorSize);
+	m_Statistics.readBlockCount++;
+	// 伝送路のノイズの代わり
+	if ((m_Timing.readCrcErrorInterval != 0) && ((m_Statistics.readBlockCount % m_Timing.readCrcErrorInterval) == 0)) {
+		m_Packet[1 + SectorSize] ^= 0x01;
+	}
+	return true;
+}
+
+// SCR の DATA_STAT_AFTER_ERASE は 0 なので消去後は 0x00 になる
+void SdCardSimulator::EraseSectors(uint32_t start, uint32_t end)
+{
+	static const uint8_t Zero[SectorSize] = {};
+	fseek(m_pImage, static_cast<long>(start) * SectorSize, SEEK_SET);
+	for (uint32_t sector = start; sector <= end; sector++) {
+		fwrite(Zero, 1, SectorSize, m_pImage);
+	}
+}
+
+void SdCardSimulator::LoadPacket(const uint8_t *pData, uint32_t size)
+{
+	uint16_t crc = GetCrc16(pData, size);
+	m_Packet[0] = 0xFE;
+	memcpy(&m_Packet[1], pData, size);
+	m_Packet[1 + size] = static_cast<uint8_t>(crc >> 8);
+	m_Packet[2 + size] = static_cast<uint8_t>(crc >> 0);
+	m_PacketLength = size + 3;
+	m_PacketPosition = 0;
+	m_IsPacketLoaded = true;
+}
+
+void SdCardSimulator::BuildCsd(uint8_t *pOut) const
+{
+	// CSD Version 2.0 (SDHC/SDXC)
+	memset(pOut, 0, 16);
+	SetBits(pOut, 16, 127, 126, 1);					// CSD_STRUCTURE
+	SetBits(pOut, 16, 119, 112, 0x0E);				// TAAC (1.0ms)
+	SetBits(pOut, 16, 103,  96, 0x32);				// TRAN_SPEED (25MHz)
+	SetBits(pOut, 16,  95,  84, 0x5B5);				// CCC
+	SetBits(pOut, 16,  83,  80, 9);					// READ_BL_LEN (512)
+	SetBits(pOut, 16,  69,  48, m_SectorCount / 1024 - 1);	// C_SIZE (容量 = (C_SIZE + 1) * 512KiB)
+	SetBits(pOut, 16,  46,  46, 1);					// ERASE_BLK_EN
+	SetBits(pOut, 16,  45,  39, 0x7F);				// SECTOR_SIZE
+	SetBits(pOut, 16,  28,  26, 2);					// R2W_FACTOR
+	SetBits(pOut, 16,  25,  22, 9);					// WRITE_BL_LEN (512)
+	SetRegisterCrc(pOut, 16);
+}
+
+void SdCardSimulator::BuildCid(uint8_t *pOut) const
+{
+	memset(pOut, 0, 16);
+	pOut[0] = 0x00;									// MID
+	pOut[1] = 'S';									// OID
+	pOut[2] = 'M';
+	memcpy(&pOut[3], "SDSIM", 5);					// PNM
+	pOut[8] = 0x10;									// PRV
+	pOut[9] = 0x12;									// PSN
+	pOut[10] = 0x34;
+	pOut[11] = 0x56;
+	pOut[12] = 0x78;
+	SetBits(pOut, 16, 19, 8, (21 << 4) | 1);		// MDT (2021/01)
+	SetRegisterCrc(pOut, 16);
+}
+
+void SdCardSimulator::BuildScr(uint8_t *pOut) const
+{
+	memset(pOut, 0, 8);
+	SetBits(pOut, 8, 59, 56, 2);					// SD_SPEC (Ver 2.00/3.0x)
+	SetBits(pOut, 8, 54, 52, 3);					// SD_SECURITY (SDHC)
+	SetBits(pOut, 8, 51, 48, 0x5);					// SD_BUS_WIDTHS (1bit/4bit)
+	SetBits(pOut, 8, 47, 47, 1);					// SD_SPEC3
+}
+
+void SdCardSimulator::BuildSsr(uint8_t *pOut) const
+{
+	memset(pOut, 0, 64);
+	SetBits(pOut, 64, 447, 440, 4);					// SPEED_CLASS (Class 10)
+	SetBits(pOut, 64, 431, 428, 9);					// AU_SIZE (4MB)
+	SetBits(pOut, 64, 423, 408, 1);					// ERASE_SIZE
+	SetBits(pOut, 64, 407, 402, 1);					// ERASE_TIMEOUT
+}
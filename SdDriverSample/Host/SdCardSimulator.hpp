@@ -0,0 +1,123 @@
+#ifndef SD_CARD_SIMULATOR_HPP
+#define SD_CARD_SIMULATOR_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+
+// ----------------------------------------------------------------------
+//  SPI モード SD カード (SDHC/SDXC) のシミュレータ
+// ----------------------------------------------------------------------
+// ディスクイメージファイルをカードの中身として、1 バイトずつの SPI 送受信に
+// 応答する。時間はすべて仮想時間 [ns] で、呼び出し側が現在時刻を渡す。
+//
+// 対応コマンド: CMD0/8/9/10/12/13/16/17/18/24/25/32/33/38/55/58/59, ACMD13/41/51
+class SdCardSimulator
+{
+public:
+	// 遅延モデル
+	struct Timing {
+		uint32_t readLatencyUs;		// CMD17/CMD18 から最初のデータ開始トークンまで
+		uint32_t nextBlockUs;		// CMD18 のブロック間
+		uint32_t writeBusyUs;		// データレスポンス後の Busy (CMD25 では Stop Tran トークン後)
+		uint32_t multiWriteBusyUs;	// CMD25 の各ブロックのデータレスポンス後の Busy (書き込みバッファへの転送)
+		uint32_t stopBusyUs;		// CMD12 / Stop Tran トークン後の Busy
+		uint32_t eraseBusyUs;		// CMD38 後の Busy
+		uint32_t gcInterval;		// この回数の書き込み毎に gcBusyUs の Busy を追加する (0 なら無効)
+		uint32_t gcBusyUs;
+		uint32_t initRetries;		// ACMD41 が初期化完了を返すまでの回数
+		uint32_t readCrcErrorInterval;	// この回数の読み出し毎にデータパケットの CRC を壊す (0 なら無効)
+	};
+
+	static const Timing DefaultTiming;
+
+	// 統計
+	struct Statistics {
+		uint32_t commandCount;
+		uint32_t readBlockCount;
+		uint32_t writeBlockCount;
+		uint32_t crcErrorCount;
+	};
+
+private:
+	enum class State {
+		Ready,				// コマンド待ち
+		ReadSingle,			// CMD17/CMD9/CMD10/ACMD13/ACMD51 のデータ送信
+		ReadMultiple,		// CMD18 のデータ送信 (CMD12 まで)
+		WriteSingle,		// CMD24 のデータ受信待ち
+		WriteMultiple,		// CMD25 のデータ受信待ち (Stop Tran トークンまで)
+		WriteData,			// データブロック受信中
+	};
+
+	static constexpr uint32_t SectorSize = 512;
+
+	FILE *m_pImage;
+	uint32_t m_SectorCount;
+	Timing m_Timing;
+	Statistics m_Statistics;
+
+	bool m_IsSelected;
+	bool m_IsIdle;
+	bool m_IsAppCommand;
+	bool m_IsCrcEnabled;
+	uint32_t m_InitCount;
+	State m_State;
+
+	// コマンド受信
+	uint8_t m_Command[6];
+	uint32_t m_CommandLength;
+
+	// 送信待ちのレスポンス (データパケットより先に出す)
+	std::deque<uint8_t> m_Response;
+	// Busy 解除時刻
+	uint64_t m_BusyUntil;
+
+	// データパケット ([トークン][データ][CRC])
+	uint8_t m_Packet[1 + SectorSize + 2];
+	uint32_t m_PacketLength;
+	uint32_t m_PacketPosition;
+	bool m_IsPacketLoaded;
+	uint64_t m_PacketReadyAt;	// この時刻までは 0xFF を返す
+
+	uint32_t m_Sector;			// 読み書き中のセクタ
+	uint32_t m_EraseStart;		// CMD32 で指定された消去範囲の先頭
+	uint32_t m_EraseEnd;		// CMD33 で指定された消去範囲の末尾
+	uint32_t m_WriteCount;		// GC モデル用の書き込み回数
+	bool m_IsMultipleWrite;
+
+public:
+	SdCardSimulator(FILE *pImage, uint32_t sectorCount, const Timing &timing);
+
+	void SetSelected(bool isSelected);
+	uint8_t Exchange(uint8_t mosi, uint64_t now);
+
+	// DO ラインが Lo (Busy) の間は true (非選択中はプルアップで Hi)
+	bool IsBusy(uint64_t now) const;
+	// Busy が解除される時刻 [ns]
+	uint64_t GetBusyUntil() const;
+
+	const Statistics &GetStatistics() const;
+
+	static uint8_t GetCrc7(const uint8_t *pData, uint32_t size);
+	static uint16_t GetCrc16(const uint8_t *pData, uint32_t size);
+
+private:
+	uint8_t GetOutput(uint64_t now);
+	void ProcessInput(uint8_t mosi, uint64_t now);
+	void ExecuteCommand(uint64_t now);
+	void ReceiveWriteData(uint8_t mosi, uint64_t now);
+
+	uint8_t GetR1() const;
+	void PushResponse(uint8_t data);
+	void PrepareRegister(const uint8_t *pData, uint32_t size, uint64_t now);
+	bool LoadSector(uint32_t sector);
+	void EraseSectors(uint32_t start, uint32_t end);
+	void LoadPacket(const uint8_t *pData, uint32_t size);
+
+	void BuildCsd(uint8_t *pOut) const;
+	void BuildCid(uint8_t *pOut) const;
+	void BuildScr(uint8_t *pOut) const;
+	void BuildSsr(uint8_t *pOut) const;
+};
+
+#endif /* SD_CARD_SIMULATOR_HPP */
@@ -0,0 +1,156 @@
+#include "SimulatorTransport.hpp"
+#include "HostHal.hpp"
+#include <cstdio>
+#include <cstdlib>
+
+// ----------------------------------------------------------------------
+//  static private functions
+// ----------------------------------------------------------------------
+namespace {
+
+// WaitBusyInterrupt() に渡されうるタイムアウトの上限 (消去でも数秒なので十分大きい値)
+// 残り時間の計算が負に回り込むと約 49 日になるので、それを眠り続ける前に検出する。
+constexpr uint32_t BusyTimeoutLimitMs = 24 * 60 * 60 * 1000;
+
+constexpr uint64_t NsPerMs = 1000000;
+
+} // namespace
+
+// ----------------------------------------------------------------------
+//  class public methods
+// ----------------------------------------------------------------------
+SimulatorTransport::SimulatorTransport(SdCardSimulator *pCard, uint32_t callOverheadNs)
+	: m_pCard(pCard)
+	, m_CallOverheadNs(callOverheadNs)
+	, m_ByteTimeNs(0)
+	, m_IsCrcActive(false)
+	, m_TxCrc(0)
+	, m_RxCrc(0)
+	, m_IsBusyInterruptLost(false)
+{
+	SetClock(HAL_RCC_GetPCLK2Freq() / 2);
+}
+
+const char *SimulatorTransport::GetName() const
+{
+	return "Sim";
+}
+
+void SimulatorTransport::Select()
+{
+	HostHal::Advance(m_CallOverheadNs);
+	m_pCard->SetSelected(true);
+}
+
+void SimulatorTransport::Deselect()
+{
+	HostHal::Advance(m_CallOverheadNs);
+	m_pCard->SetSelected(false);
+}
+
+// 実機の SPI と同じく PCLK2 の 2^n 分周 (n = 1 - 8) で近似する
+uint32_t SimulatorTransport::SetClock(uint32_t maxClock)
+{
+	const uint32_t pclk = HAL_RCC_GetPCLK2Freq();
+
+	uint32_t shift = 1;
+	while ((shift < 8) && ((pclk >> shift) > maxClock)) {
+		shift++;
+	}
+
+	uint32_t clock = pclk >> shift;
+	m_ByteTimeNs = 8ULL * 1000000000ULL / clock;
+	return clock;
+}
+
+uint8_t SimulatorTransport::Exchange(uint8_t txData)
+{
+	HostHal::Advance(m_CallOverheadNs);
+	return ExchangeByte(txData);
+}
+
+void SimulatorTransport::Send(const uint8_t *pData, uint32_t size)
+{
+	HostHal::Advance(m_CallOverheadNs);
+	for (uint32_t i = 0; i < size; i++) {
+		ExchangeByte(pData[i]);
+	}
+}
+
+void SimulatorTransport::Receive(uint8_t *pOutData, uint32_t size)
+{
+	HostHal::Advance(m_CallOverheadNs);
+	for (uint32_t i = 0; i < size; i++) {
+		pOutData[i] = ExchangeByte(0xFF);
+	}
+}
+
+bool SimulatorTransport::IsHardwareCrcSupported() const
+{
+	return true;
+}
+
+void SimulatorTransport::BeginHardwareCrc()
+{
+	m_IsCrcActive = true;
+	m_TxCrc = 0;
+	m_RxCrc = 0;
+}
+
+uint16_t SimulatorTransport::EndHardwareCrc(bool isReceive)
+{
+	m_IsCrcActive = false;
+	return isReceive ? m_RxCrc : m_TxCrc;
+}
+
+bool SimulatorTransport::IsBusyInterruptSupported() const
+{
+	return true;
+}
+
+// SdSpiTransport::WaitBusyInterrupt() と同じく、DO の立ち上がりか SysTick (1ms 毎) で起きてタイムアウトを確認する
+bool SimulatorTransport::WaitBusyInterrupt(uint32_t timeoutMs)
+{
+	if (timeoutMs > BusyTimeoutLimitMs) {
+		fprintf(stderr, "SimulatorTransport: busy wait timeout %lu ms is out of range\n", (unsigned long)timeoutMs);
+		exit(EXIT_FAILURE);
+	}
+
+	// ピンの切り替えと戻しの分
+	HostHal::Advance(m_CallOverheadNs * 2);
+
+	const uint32_t startTick = HAL_GetTick();
+	while (m_IsBusyInterruptLost || m_pCard->IsBusy(HostHal::GetTimeNs())) {
+		if ((HAL_GetTick() - startTick) > timeoutMs) {
+			return false;
+		}
+		uint64_t now = HostHal::GetTimeNs();
+		uint64_t wakeAt = (now / NsPerMs + 1) * NsPerMs;
+		if (!m_IsBusyInterruptLost && m_pCard->GetBusyUntil() < wakeAt) {
+			wakeAt = m_pCard->GetBusyUntil();
+		}
+		HostHal::Advance(wakeAt - now);
+	}
+	return true;
+}
+
+void SimulatorTransport::SetBusyInterruptLost(bool isLost)
+{
+	m_IsBusyInterruptLost = isLost;
+}
+
+// ----------------------------------------------------------------------
+//  class private methods
+// ----------------------------------------------------------------------
+uint8_t SimulatorTransport::ExchangeByte(uint8_t txData)
+{
+	uint8_t rxData = m_pCard->Exchange(txData, HostHal::GetTimeNs());
+
+	if (m_IsCrcActive) {
+		m_TxCrc = HostHal::UpdateCrc16(m_TxCrc, 0x1021, txData);
+		m_RxCrc = HostHal::UpdateCrc16(m_RxCrc, 0x1021, rxData);
+	}
+
+	HostHal::Advance(m_ByteTimeNs);
+	return rxData;
+}
@@ -0,0 +1,56 @@
+#ifndef SIMULATOR_TRANSPORT_HPP
+#define SIMULATOR_TRANSPORT_HPP
+
+#include "SdTransport.hpp"
+#include "SdCardSimulator.hpp"
+
+// ----------------------------------------------------------------------
+//  SD カードシミュレータに直接つなぐ通信路
+// ----------------------------------------------------------------------
+// HAL のスタブを経由しないので、仮想時間は SPI の転送時間と
+// 呼び出し 1 回あたりの固定オーバーヘッド (callOverheadNs) だけ進む。
+// HAL/DMA 版との差がそのまま通信路のオーバーヘッドの目安になる。
+class SimulatorTransport : public SdTransport
+{
+private:
+	SdCardSimulator *m_pCard;
+	uint32_t m_CallOverheadNs;
+
+	// 1 バイトの転送時間 [ns]
+	uint64_t m_ByteTimeNs;
+
+	// CRC 計算ユニット相当
+	bool m_IsCrcActive;
+	uint16_t m_TxCrc;
+	uint16_t m_RxCrc;
+
+	// Busy 解除の割り込みを取りこぼす (SysTick でしか起きず、タイムアウトまで眠る)
+	bool m_IsBusyInterruptLost;
+
+public:
+	SimulatorTransport(SdCardSimulator *pCard, uint32_t callOverheadNs);
+
+	const char *GetName() const override;
+
+	void Select() override;
+	void Deselect() override;
+	uint32_t SetClock(uint32_t maxClock) override;
+
+	uint8_t Exchange(uint8_t txData) override;
+	void Send(const uint8_t *pData, uint32_t size) override;
+	void Receive(uint8_t *pOutData, uint32_t size) override;
+
+	bool IsHardwareCrcSupported() const override;
+	void BeginHardwareCrc() override;
+	uint16_t EndHardwareCrc(bool isReceive) override;
+
+	// 実機の SdSpiTransport (MISO の EXTI) 相当
+	bool IsBusyInterruptSupported() const override;
+	bool WaitBusyInterrupt(uint32_t timeoutMs) override;
+	void SetBusyInterruptLost(bool isLost);
+
+private:
+	uint8_t ExchangeByte(uint8_t txData);
+};
+
+#endif /* SIMULATOR_TRANSPORT_HPP */